@@ -36,19 +36,32 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/BasicBlock.h"
-#include "llvm/IR/CallSite.h"
 #include "llvm/IR/Instruction.h"
-#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/TypeFinder.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
-#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Type.h"
 
 // standard
 #include <vector>
 #include <string>
-#include <fstream>
+#include <memory>
 
 // project
 #include "prefetcher.hpp"
@@ -68,7 +81,31 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 llvm::cl::opt<std::string> FunctionWhiteListFile(
 		"func-wl-file", llvm::cl::Hidden,
-		llvm::cl::desc("function whitelist file"));
+		llvm::cl::desc("function whitelist file: one name or /regex/ per line, "
+				"lines starting with ! exclude"));
+
+llvm::cl::opt<std::string> FunctionBlackListFile(
+		"func-bl-file", llvm::cl::Hidden,
+		llvm::cl::desc("function blacklist file: one name or /regex/ per line"));
+
+llvm::cl::opt<bool> DetectSinVal(
+		"prefetcher-sinval", llvm::cl::init(true), llvm::cl::Hidden,
+		llvm::cl::desc("detect single-valued indirection (A[B[i]])"));
+
+llvm::cl::opt<bool> DetectRanged(
+		"prefetcher-ranged", llvm::cl::init(true), llvm::cl::Hidden,
+		llvm::cl::desc("detect ranged indirection (A[B[i]..B[i+1]])"));
+
+llvm::cl::opt<unsigned> AnalysisThreads(
+		"prefetcher-analysis-threads", llvm::cl::init(0), llvm::cl::Hidden,
+		llvm::cl::desc("threads detecting the indirections of the functions "
+				"of a module (0: one per hardware thread)"));
+
+STATISTIC(NumSinValEdges, "Number of single-valued indirections found");
+STATISTIC(NumSinValFunctions, "Number of functions with single-valued indirections");
+STATISTIC(NumRangedEdges, "Number of ranged indirections found");
+STATISTIC(NumRangedFunctions, "Number of functions with ranged indirections");
+STATISTIC(NumRangedIndexed, "Number of ranged indirections whose bound indexes memory");
 
 namespace {
 
@@ -81,7 +118,8 @@ bool getAllocationSizeCalc(llvm::Value &I, std::set<llvm::Value *> &vals, int st
 			if (auto *user = llvm::dyn_cast<llvm::Instruction>(Instr->getOperand(i))) {
 
 				if (user->getOpcode() == Instruction::Call) {
-					if (dyn_cast<llvm::CallInst>(user)->getCalledFunction()->getName().str() == std::string("llvm.umul.with.overflow.i64")) {
+					llvm::Function *callee = dyn_cast<llvm::CallInst>(user)->getCalledFunction();
+					if (callee && callee->getName().str() == std::string("llvm.umul.with.overflow.i64")) {
 						ret = true;
 						vals.insert(user);
 						return true;
@@ -98,33 +136,309 @@ bool getAllocationSizeCalc(llvm::Value &I, std::set<llvm::Value *> &vals, int st
 	return ret;
 }
 
-void identifyNewA(llvm::Function &F,
-		llvm::SmallVectorImpl<myAllocCallInfo> &allocInfos) {
+// Element size implied by how the allocated pointer, or a bitcast of it, is
+// used, or 0: the type indexed by a GEP on it, else the type loaded or
+// stored through it. Byte accesses say nothing about the element size.
+uint64_t getElementSizeFromType(llvm::Instruction *base) {
+	const llvm::DataLayout &DL = base->getModule()->getDataLayout();
+
+	llvm::SmallVector<llvm::Value *, 4> ptrs;
+	ptrs.push_back(base);
+	for (auto *user : base->users()) {
+		if (llvm::isa<llvm::BitCastInst>(user)) {
+			ptrs.push_back(user);
+		}
+	}
+
+	llvm::Type *accessTy = nullptr;
+	for (auto *ptr : ptrs) {
+		for (auto *user : ptr->users()) {
+			llvm::Type *elemTy = nullptr;
+			if (auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(user)) {
+				if (gep->getPointerOperand() == ptr) {
+					elemTy = gep->getSourceElementType();
+				}
+			}
+			else if (auto *ld = llvm::dyn_cast<llvm::LoadInst>(user)) {
+				if (!accessTy) {
+					accessTy = ld->getType();
+				}
+			}
+			else if (auto *st = llvm::dyn_cast<llvm::StoreInst>(user)) {
+				if (st->getPointerOperand() == ptr && !accessTy) {
+					accessTy = st->getValueOperand()->getType();
+				}
+			}
+
+			if (elemTy && elemTy->isSized() && !elemTy->isIntegerTy(8)) {
+				return DL.getTypeAllocSize(elemTy);
+			}
+		}
+	}
+
+	if (accessTy && accessTy->isSized() && !accessTy->isIntegerTy(8)) {
+		return DL.getTypeAllocSize(accessTy);
+	}
+
+	return 0;
+}
+
+// Constant factor of an allocation size, i.e. the size of one element when
+// the size is count * elem_size, or 0 if it has none. The size is folded
+// by ScalarEvolution, so shifts and multiplies whose overflow check was
+// removed are handled. A constant size is returned as is; it is the whole
+// allocation rather than one element.
+uint64_t getConstantSizeFactor(llvm::Value *size, llvm::ScalarEvolution &SE) {
+	// look through the overflow check of new[]: select(ov, -1, size)
+	if (auto *sel = llvm::dyn_cast<llvm::SelectInst>(size)) {
+		if (auto *c = llvm::dyn_cast<llvm::ConstantInt>(sel->getTrueValue())) {
+			if (c->isMinusOne()) {
+				size = sel->getFalseValue();
+			}
+		}
+	}
+
+	if (!SE.isSCEVable(size->getType())) {
+		return 0;
+	}
+
+	const llvm::SCEV *S = SE.getSCEV(size);
+
+	while (auto *cast = llvm::dyn_cast<llvm::SCEVCastExpr>(S)) {
+		S = cast->getOperand();
+	}
+
+	if (auto *c = llvm::dyn_cast<llvm::SCEVConstant>(S)) {
+		return c->getAPInt().getLimitedValue();
+	}
+
+	// constants are always the first operand of a SCEV multiply
+	if (auto *mul = llvm::dyn_cast<llvm::SCEVMulExpr>(S)) {
+		if (auto *c = llvm::dyn_cast<llvm::SCEVConstant>(mul->getOperand(0))) {
+			return c->getAPInt().getLimitedValue();
+		}
+	}
+
+	return 0;
+}
+
+// Size in bytes of the elements of an allocation, recovered as the
+// (count, elem_size) decomposition of its size. An overflow checked
+// multiply gives it directly. Otherwise the constant factor of the size
+// is used, refined by the type the allocated pointer is used as when that
+// divides it.
+llvm::Value *getElementSize(llvm::Value *size, llvm::Instruction *base,
+		llvm::ScalarEvolution &SE) {
+	std::set<llvm::Value*> vals;
+	if (getAllocationSizeCalc(*size, vals)) {
+		return llvm::cast<llvm::CallInst>(*vals.begin())->getArgOperand(1);
+	}
+
+	auto *i64Ty = llvm::Type::getInt64Ty(base->getContext());
+	uint64_t typeSize = getElementSizeFromType(base);
+	uint64_t factor = getConstantSizeFactor(size, SE);
+
+	// a constant size has no count to split off, so without a type that
+	// divides it the allocation is taken to hold bytes
+	if (SE.isSCEVable(size->getType()) && llvm::isa<llvm::SCEVConstant>(SE.getSCEV(size))) {
+		bool divides = typeSize && factor % typeSize == 0;
+		return llvm::ConstantInt::get(i64Ty, divides ? typeSize : 1);
+	}
+
+	if (typeSize && (!factor || factor % typeSize == 0)) {
+		return llvm::ConstantInt::get(i64Ty, typeSize);
+	}
+
+	if (factor) {
+		return llvm::ConstantInt::get(i64Ty, factor);
+	}
+
+	return nullptr;
+}
+
+// Whether I may overwrite the pointer slot memptr. Only stores to it and
+// calls it is passed to can, unless it is not a local that stays private
+// to the function, in which case any call may.
+bool mayWriteSlot(llvm::Instruction &I, llvm::Value *memptr) {
+	if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(&I)) {
+		return SI->getPointerOperand()->stripPointerCasts() == memptr;
+	}
+
+	auto *CB = llvm::dyn_cast<llvm::CallBase>(&I);
+	if (!CB || !CB->mayWriteToMemory() || llvm::isa<llvm::DbgInfoIntrinsic>(CB)) {
+		return false;
+	}
+	if (!llvm::isa<llvm::AllocaInst>(memptr)) {
+		return true;
+	}
+	for (llvm::Value *arg : CB->args()) {
+		if (arg->stripPointerCasts() == memptr) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// posix_memalign returns the allocation through its first argument. The
+// node base is the first load of that pointer, in function order, among
+// those the call dominates and that no write to the pointer can reach from
+// the call, e.g. the load after an "if (posix_memalign(&p, ...)) abort();"
+// check. DT is built on first use.
+llvm::Instruction *getPosixMemalignBase(llvm::CallBase &CB,
+		std::unique_ptr<llvm::DominatorTree> &DT) {
+	llvm::Value *memptr = CB.getArgOperand(0)->stripPointerCasts();
+	llvm::Function &F = *CB.getFunction();
+
+	if (!DT) {
+		DT = std::make_unique<llvm::DominatorTree>(F);
+	}
+
+	llvm::SmallVector<llvm::Instruction *, 4> loads;
+	llvm::SmallVector<llvm::Instruction *, 4> writes;
 	for (llvm::BasicBlock &BB : F) {
 		for (llvm::Instruction &I : BB) {
-			llvm::CallSite CS(&I);
-			if (!CS.getInstruction()) {
+			if (&I == &CB) {
 				continue;
 			}
-			llvm::Value *called = CS.getCalledValue()->stripPointerCasts();
-
-			if (llvm::Function *f = llvm::dyn_cast<llvm::Function>(called)) {
-				if (f->getName().equals("_Znam")) {
-					std::set<llvm::Value*> vals;
-					getAllocationSizeCalc(*(CS.getArgOperand(0)),vals);
-					if (vals.size() > 0) {
-						for (auto v : vals) {
-							CallSite size(v);
-							myAllocCallInfo allocInfo;
-							allocInfo.allocInst = &I;
-							allocInfo.inputArguments.insert(allocInfo.inputArguments.end(),CS.getArgOperand(0));
-							allocInfo.inputArguments.insert(allocInfo.inputArguments.end(),size.getArgOperand(1));
-							allocInfos.push_back(allocInfo);
-						}
-					}
-					else { }
+
+			auto *LI = llvm::dyn_cast<llvm::LoadInst>(&I);
+			if (LI && LI->getPointerOperand()->stripPointerCasts() == memptr) {
+				if (DT->dominates(&CB, LI)) {
+					loads.push_back(LI);
 				}
 			}
+			else if (mayWriteSlot(I, memptr)) {
+				writes.push_back(&I);
+			}
+		}
+	}
+
+	for (llvm::Instruction *LI : loads) {
+		bool clobbered = false;
+		for (llvm::Instruction *W : writes) {
+			if (llvm::isPotentiallyReachable(&CB, W, nullptr, DT.get()) &&
+					llvm::isPotentiallyReachable(W, LI, nullptr, DT.get())) {
+				clobbered = true;
+				break;
+			}
+		}
+		if (!clobbered) {
+			return LI;
+		}
+	}
+
+	return nullptr;
+}
+
+// Allocation functions sized by their first argument alone: malloc, valloc
+// and every form of operator new and new[].
+bool isSingleSizeAlloc(llvm::LibFunc libFunc) {
+	switch (libFunc) {
+	case llvm::LibFunc_malloc:
+	case llvm::LibFunc_valloc:
+	case llvm::LibFunc_Znwj:
+	case llvm::LibFunc_ZnwjRKSt9nothrow_t:
+	case llvm::LibFunc_ZnwjSt11align_val_t:
+	case llvm::LibFunc_ZnwjSt11align_val_tRKSt9nothrow_t:
+	case llvm::LibFunc_Znwm:
+	case llvm::LibFunc_ZnwmRKSt9nothrow_t:
+	case llvm::LibFunc_ZnwmSt11align_val_t:
+	case llvm::LibFunc_ZnwmSt11align_val_tRKSt9nothrow_t:
+	case llvm::LibFunc_Znaj:
+	case llvm::LibFunc_ZnajRKSt9nothrow_t:
+	case llvm::LibFunc_ZnajSt11align_val_t:
+	case llvm::LibFunc_ZnajSt11align_val_tRKSt9nothrow_t:
+	case llvm::LibFunc_Znam:
+	case llvm::LibFunc_ZnamRKSt9nothrow_t:
+	case llvm::LibFunc_ZnamSt11align_val_t:
+	case llvm::LibFunc_ZnamSt11align_val_tRKSt9nothrow_t:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool isNumaAlloc(llvm::StringRef name) {
+	return name == "numa_alloc" || name == "numa_alloc_local" ||
+		name == "numa_alloc_onnode" || name == "numa_alloc_interleaved";
+}
+
+// Recognises heap allocations that become DIG nodes: malloc, valloc, calloc,
+// aligned_alloc, memalign, posix_memalign, numa_alloc* and all forms of
+// operator new. Other allocation functions are not registered.
+void identifyAllocations(llvm::Function &F, llvm::TargetLibraryInfo &TLI,
+		llvm::ScalarEvolution &SE, llvm::SmallVectorImpl<myAllocCallInfo> &allocInfos) {
+	// only needed for posix_memalign
+	std::unique_ptr<llvm::DominatorTree> DT;
+
+	for (llvm::BasicBlock &BB : F) {
+		for (llvm::Instruction &I : BB) {
+			auto *CB = llvm::dyn_cast<llvm::CallBase>(&I);
+			if (!CB) {
+				continue;
+			}
+
+			auto *f = llvm::dyn_cast<llvm::Function>(CB->getCalledOperand()->stripPointerCasts());
+			if (!f) {
+				continue;
+			}
+
+			llvm::LibFunc libFunc;
+			bool isLibFunc = TLI.getLibFunc(*f, libFunc) && TLI.has(libFunc);
+
+			myAllocCallInfo allocInfo;
+			llvm::Value *size = nullptr;
+
+			if (isLibFunc && libFunc == llvm::LibFunc_posix_memalign) {
+				allocInfo.allocInst = getPosixMemalignBase(*CB, DT);
+				size = CB->getArgOperand(2);
+			}
+			else if (isLibFunc && libFunc == llvm::LibFunc_calloc) {
+				allocInfo.allocInst = &I;
+				allocInfo.sizeIsCount = true;
+				allocInfo.inputArguments.push_back(CB->getArgOperand(0));
+				allocInfo.inputArguments.push_back(CB->getArgOperand(1));
+			}
+			else if (isLibFunc && (libFunc == llvm::LibFunc_aligned_alloc ||
+					libFunc == llvm::LibFunc_memalign)) {
+				allocInfo.allocInst = &I;
+				size = CB->getArgOperand(1);
+			}
+			else if (isLibFunc && isSingleSizeAlloc(libFunc)) {
+				allocInfo.allocInst = &I;
+				size = CB->getArgOperand(0);
+			}
+			else if (isNumaAlloc(f->getName())) {
+				allocInfo.allocInst = &I;
+				size = CB->getArgOperand(0);
+			}
+
+			if (!allocInfo.allocInst || (!size && !allocInfo.sizeIsCount)) {
+				continue;
+			}
+
+			// the node of an invoked allocation is registered at the start of
+			// its normal destination, which has to be reached from it only
+			auto *II = llvm::dyn_cast<llvm::InvokeInst>(allocInfo.allocInst);
+			if (II && !II->getNormalDest()->getSinglePredecessor()) {
+				llvm::errs() << "skipping allocation: " << I << " reason: critical normal edge\n";
+				continue;
+			}
+
+			if (allocInfo.sizeIsCount) {
+				allocInfos.push_back(allocInfo);
+				continue;
+			}
+
+			llvm::Value *elemSize = getElementSize(size, allocInfo.allocInst, SE);
+			if (!elemSize) {
+				llvm::errs() << "skipping allocation: " << I << " reason: unknown element size\n";
+				continue;
+			}
+
+			allocInfo.inputArguments.push_back(size);
+			allocInfo.inputArguments.push_back(elemSize);
+			allocInfos.push_back(allocInfo);
 		}
 	}
 }
@@ -141,15 +455,32 @@ bool isTargetGEPusedInLoad(llvm::Instruction *I) {
 	return false;
 }
 
-llvm::Instruction * findGEPToSameBasePtr(llvm::Function &F, llvm::Instruction & firstI) {
+// GEPs of a function bucketed by base pointer, in function order, so that
+// GEPs sharing a base can be found without rescanning the function.
+using GEPBaseIndex =
+		llvm::DenseMap<llvm::Value *, llvm::SmallVector<llvm::Instruction *, 4>>;
+
+void buildGEPBaseIndex(llvm::Function &F, GEPBaseIndex &index) {
 	for (llvm::BasicBlock &BB : F) {
 		for (llvm::Instruction &I : BB) {
-			if (I.getOpcode() == llvm::Instruction::GetElementPtr &&
-					firstI.getOperand(0) == I.getOperand(0) && &firstI != &I) {
-				return &I;
+			if (I.getOpcode() == llvm::Instruction::GetElementPtr) {
+				index[I.getOperand(0)].push_back(&I);
 			}
 		}
 	}
+}
+
+llvm::Instruction * findGEPToSameBasePtr(const GEPBaseIndex &index, llvm::Instruction & firstI) {
+	auto found = index.find(firstI.getOperand(0));
+	if (found == index.end()) {
+		return nullptr;
+	}
+
+	for (llvm::Instruction *I : found->second) {
+		if (I != &firstI) {
+			return I;
+		}
+	}
 	return nullptr;
 }
 
@@ -239,26 +570,62 @@ void getLoadsUsingSourceGEP(llvm::Instruction * I, llvm::SmallVectorImpl<llvm::I
 	}
 }
 
-void getGEPsUsingLoad(llvm::Instruction * I, llvm::SmallVectorImpl<llvm::Instruction*> & target_geps, int iter = 0)
+// Finds the GEPs that use the loaded value I as an index, looking through
+// the index arithmetic in between, together with the operand the value is
+// used as. The walk stops at the next load, so only the immediate hop of a
+// chain is returned.
+void getGEPsUsingLoad(llvm::Instruction * I, llvm::SmallVectorImpl<std::pair<llvm::Instruction*, unsigned>> & target_geps, int iter = 0)
 {
 	for (auto &u : I->uses()) {
 		auto *user = llvm::dyn_cast<llvm::Instruction>(u.getUser());
 
-		if (user->getOpcode() == Instruction::Store) { }
-		else if (user->getOpcode() == Instruction::GetElementPtr) {
-			if (user->getOperand(1) == I) { // GEP is dependent only if load result is used as an index
-				target_geps.push_back(user);
+		if (user->getOpcode() == Instruction::GetElementPtr) {
+			if (u.getOperandNo() >= 1) { // GEP is dependent only if load result is used as an index
+				target_geps.push_back({user, u.getOperandNo()});
 			}
 		}
-		else if (user->getOpcode() == Instruction::Load) { }
+		else if (iter < 5 && (llvm::isa<llvm::CastInst>(user) || llvm::isa<llvm::BinaryOperator>(user) ||
+					llvm::isa<llvm::PHINode>(user) || llvm::isa<llvm::SelectInst>(user))) {
+			// Allow up to five modifications of the value between the load and the GEP
+			getGEPsUsingLoad(user, target_geps, iter + 1);
+		}
+	}
+}
+
+// Size in bytes of the elements selected by index operand idx of a GEP, and
+// the constant offset of the addressed field within them, e.g. for
+// nodes[i].edges or matrix[0][i]. Fails if any other index is not constant.
+bool getFieldLayout(llvm::Instruction * gep, unsigned idx, uint64_t & offset, uint64_t & stride)
+{
+	const llvm::DataLayout &DL = gep->getModule()->getDataLayout();
+	unsigned op = 1;
+
+	offset = 0;
+	stride = 0;
+
+	for (auto GTI = llvm::gep_type_begin(gep), E = llvm::gep_type_end(gep); GTI != E; ++GTI, ++op) {
+		if (op == idx) {
+			if (GTI.isStruct()) {
+				return false;
+			}
+			stride = DL.getTypeAllocSize(GTI.getIndexedType());
+			continue;
+		}
+
+		auto *c = llvm::dyn_cast<llvm::ConstantInt>(GTI.getOperand());
+		if (!c) {
+			return false;
+		}
 
-		if (iter < 5) { // Allow up to three modifications of value between gep calc and load, provided that they are not a store or another GEP
-			getGEPsUsingLoad(user, target_geps, ++iter);
+		if (auto *st = GTI.getStructTypeOrNull()) {
+			offset += DL.getStructLayout(st)->getElementOffset(c->getZExtValue());
 		}
 		else {
-			return;
+			offset += c->getSExtValue() * DL.getTypeAllocSize(GTI.getIndexedType());
 		}
 	}
+
+	return stride != 0;
 }
 
 bool RIfindLoadUsingGEP(llvm::Instruction * src, std::vector<llvm::Instruction *> &targets, int stack_count = 0) {
@@ -279,10 +646,13 @@ bool RIfindLoadUsingGEP(llvm::Instruction * src, std::vector<llvm::Instruction *
 }
 
 void identifyCorrectRangedIndirection(Function &F, llvm::SmallVectorImpl<GEPDepInfo> & riInfos) {
+	GEPBaseIndex index;
+	buildGEPBaseIndex(F, index);
+
 	for (llvm::BasicBlock &BB : F) {
 		for (llvm::Instruction &I : BB) {
 			if (I.getOpcode() == llvm::Instruction::GetElementPtr) {
-				llvm::Instruction * otherGEP = findGEPToSameBasePtr(F, I);
+				llvm::Instruction * otherGEP = findGEPToSameBasePtr(index, I);
 				if (otherGEP) {
 					GEPDepInfo gepdepinfo;
 					if (areUsedInComparisonOp(&I,otherGEP)) {
@@ -291,6 +661,7 @@ void identifyCorrectRangedIndirection(Function &F, llvm::SmallVectorImpl<GEPDepI
 						if (found_load) {
 							gepdepinfo.source = I.getOperand(0);
 							gepdepinfo.target = targets.at(0);
+							gepdepinfo.source_gep = &I;
 							riInfos.push_back(gepdepinfo);
 						}
 					}
@@ -300,6 +671,72 @@ void identifyCorrectRangedIndirection(Function &F, llvm::SmallVectorImpl<GEPDepI
 	}
 }
 
+// Number of edges on the longest path from edge i along next (towards the
+// end of the chain when next is keyed by source GEP, towards the trigger node
+// when keyed by target GEP). Cycles, as in p = next[p], are counted once.
+unsigned chainDistance(unsigned i, llvm::SmallVectorImpl<GEPDepInfo> &gepInfos,
+		const llvm::DenseMap<llvm::Instruction*, llvm::SmallVector<unsigned, 2>> &next,
+		bool forward, llvm::SmallVectorImpl<unsigned> &memo) {
+	if (memo[i]) {
+		return memo[i];
+	}
+	memo[i] = 1;
+
+	llvm::Instruction *link = forward ? gepInfos[i].target_gep : gepInfos[i].source_gep;
+	auto found = next.find(link);
+	if (found == next.end()) {
+		return 1;
+	}
+
+	unsigned distance = 1;
+	for (unsigned j : found->second) {
+		if (j != i) {
+			distance = std::max(distance, 1 + chainDistance(j, gepInfos, next, forward, memo));
+		}
+	}
+	return memo[i] = distance;
+}
+
+// Links the edges of multi-level chains such as A[B[C[i]]]: an edge follows
+// another when its source GEP is the target GEP of the other. Sets the level
+// of every edge and the number of edges left in its chain, at any depth.
+void linkIndirectionChains(llvm::SmallVectorImpl<GEPDepInfo> &gepInfos) {
+	llvm::DenseMap<llvm::Instruction*, llvm::SmallVector<unsigned, 2>> bySourceGEP;
+	llvm::DenseMap<llvm::Instruction*, llvm::SmallVector<unsigned, 2>> byTargetGEP;
+
+	for (unsigned i = 0; i < gepInfos.size(); ++i) {
+		bySourceGEP[gepInfos[i].source_gep].push_back(i);
+		byTargetGEP[gepInfos[i].target_gep].push_back(i);
+	}
+
+	llvm::SmallVector<unsigned, 8> length(gepInfos.size(), 0);
+	llvm::SmallVector<unsigned, 8> level(gepInfos.size(), 0);
+
+	for (unsigned i = 0; i < gepInfos.size(); ++i) {
+		gepInfos[i].chain_length = chainDistance(i, gepInfos, bySourceGEP, true, length);
+		gepInfos[i].level = chainDistance(i, gepInfos, byTargetGEP, false, level) - 1;
+	}
+}
+
+// Debug output of the single-valued indirections found in a function.
+// Printed once detection is done rather than while detecting, so that
+// functions analysed in parallel only read the IR.
+void printGEPDependence(const llvm::SmallVectorImpl<GEPDepInfo> &gepInfos) {
+#if DEBUG == 1
+	for (const GEPDepInfo &g : gepInfos) {
+		errs() << "Identify source: " << *g.source << "\n";
+		if (g.field) {
+			errs() << "Identify field: offset " << g.field_offset << " stride " << g.stride << "\n";
+		}
+		errs() << "Identify target: " << *g.target << "\n\n";
+	}
+	for (const GEPDepInfo &g : gepInfos) {
+		errs() << "Chain level " << g.level << " of "
+			<< g.level + g.chain_length << ": " << *g.target << "\n";
+	}
+#endif
+}
+
 void identifyCorrectGEPDependence(Function &F,
 		llvm::SmallVectorImpl<GEPDepInfo> &gepInfos) {
 
@@ -311,15 +748,33 @@ void identifyCorrectGEPDependence(Function &F,
 		getLoadsUsingSourceGEP(I, loads);
 
 		for (auto ld : loads) {
-			llvm::SmallVector<llvm::Instruction*,8> target_geps;
+			llvm::SmallVector<std::pair<llvm::Instruction*, unsigned>,8> target_geps;
 			getGEPsUsingLoad(ld, target_geps);
-			for (auto target_gep : target_geps) {
+			for (auto &target : target_geps) {
+				llvm::Instruction * target_gep = target.first;
+				uint64_t field_offset = 0;
+				uint64_t stride = 0;
+				bool layout = getFieldLayout(target_gep, target.second, field_offset, stride);
+
+				// Without a constant layout only A[B[i]][...] is a plain edge
+				if (!layout && target.second != 1) {
+					continue;
+				}
+
 				if (isTargetGEPusedInLoad(target_gep)) {
 					GEPDepInfo g;
+					// a field at offset 0 is indexed like the node itself
+					if (layout && field_offset != 0) {
+						g.field = true;
+						g.field_offset = field_offset;
+						g.stride = stride;
+					}
 					g.source = I->getOperand(0);
 					g.source_use = ld;
+					g.source_gep = I;
 					g.funcSource = I->getParent()->getParent();
 					g.target = target_gep->getOperand(0);
+					g.target_gep = target_gep;
 					g.funcTarget = target_gep->getParent()->getParent();
 					gepInfos.push_back(g);
 					// If the source GEP comes from a PHI node, we use the result of the phi node as the source edge, and insert the registration call
@@ -328,14 +783,12 @@ void identifyCorrectGEPDependence(Function &F,
 						g.phi_node = dyn_cast<llvm::Instruction>(ld->getOperand(0));
 						g.phi = true;
 					}
-#if DEBUG == 1
-					errs() << "Identify source: " << *g.source << "\n";
-					errs() << "Identify target: " << *g.target << "\n\n";
-#endif
 				}
 			}
 		}
 	}
+
+	linkIndirectionChains(gepInfos);
 }
 
 void removeDuplicates(std::set<GEPDepInfo> &svInfos, std::set<GEPDepInfo> &riInfos)
@@ -349,55 +802,411 @@ void removeDuplicates(std::set<GEPDepInfo> &svInfos, std::set<GEPDepInfo> &riInf
 	}
 }
 
+// Like stripPointerCasts, but keeps all-zero GEPs, which address the first
+// field of a struct.
+llvm::Value *stripBitCasts(llvm::Value *V) {
+	while (auto *cast = llvm::dyn_cast<llvm::BitCastOperator>(V)) {
+		V = cast->getOperand(0);
+	}
+	return V;
+}
+
+// Struct type and field index addressed by a GEP of the form
+// gep %struct, %p, 0, field.
+bool getStructField(llvm::Value *ptr, std::pair<llvm::Type *, unsigned> &field) {
+	auto *gep = llvm::dyn_cast<llvm::GEPOperator>(ptr);
+	if (!gep || gep->getNumIndices() != 2 || !gep->getSourceElementType()->isStructTy()) {
+		return false;
+	}
+
+	auto *first = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(1));
+	auto *second = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(2));
+	if (!first || !second || !first->isZero()) {
+		return false;
+	}
+
+	field = {gep->getSourceElementType(), (unsigned)second->getZExtValue()};
+	return true;
+}
+
 } // namespace
 
+AllocationOrigins::AllocationOrigins(llvm::Module &M) {
+	for (llvm::Function &F : M) {
+		for (llvm::BasicBlock &BB : F) {
+			for (llvm::Instruction &I : BB) {
+				auto *store = llvm::dyn_cast<llvm::StoreInst>(&I);
+				if (!store || !store->getValueOperand()->getType()->isPointerTy()) {
+					continue;
+				}
+
+				llvm::Value *ptr = stripBitCasts(store->getPointerOperand());
+				std::pair<llvm::Type *, unsigned> field;
+
+				if (llvm::isa<llvm::GlobalVariable>(ptr)) {
+					globalStores[ptr].push_back(store->getValueOperand());
+				}
+				else if (getStructField(ptr, field)) {
+					fieldStores[field].push_back(store->getValueOperand());
+				}
+			}
+		}
+	}
+}
+
+void AllocationOrigins::find(llvm::Value *V,
+		llvm::SmallPtrSetImpl<llvm::Value *> &origins) const {
+	llvm::SmallVector<llvm::Value *, 16> worklist;
+	worklist.push_back(V);
+
+	while (!worklist.empty() && origins.size() < 256) {
+		llvm::Value *v = worklist.pop_back_val()->stripPointerCasts();
+
+		if (!origins.insert(v).second) {
+			continue;
+		}
+
+		if (auto *arg = llvm::dyn_cast<llvm::Argument>(v)) {
+			for (llvm::User *user : arg->getParent()->users()) {
+				auto *CB = llvm::dyn_cast<llvm::CallBase>(user);
+				if (CB && CB->getCalledOperand()->stripPointerCasts() == arg->getParent() &&
+						arg->getArgNo() < CB->arg_size()) {
+					worklist.push_back(CB->getArgOperand(arg->getArgNo()));
+				}
+			}
+		}
+		else if (auto *CB = llvm::dyn_cast<llvm::CallBase>(v)) {
+			auto *callee = llvm::dyn_cast<llvm::Function>(CB->getCalledOperand()->stripPointerCasts());
+			if (callee && !callee->isDeclaration()) {
+				for (llvm::BasicBlock &BB : *callee) {
+					if (auto *ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator())) {
+						if (ret->getReturnValue()) {
+							worklist.push_back(ret->getReturnValue());
+						}
+					}
+				}
+			}
+		}
+		else if (auto *phi = llvm::dyn_cast<llvm::PHINode>(v)) {
+			for (llvm::Value *incoming : phi->incoming_values()) {
+				worklist.push_back(incoming);
+			}
+		}
+		else if (auto *sel = llvm::dyn_cast<llvm::SelectInst>(v)) {
+			worklist.push_back(sel->getTrueValue());
+			worklist.push_back(sel->getFalseValue());
+		}
+		else if (auto *load = llvm::dyn_cast<llvm::LoadInst>(v)) {
+			llvm::Value *ptr = stripBitCasts(load->getPointerOperand());
+			std::pair<llvm::Type *, unsigned> field;
+
+			auto global = globalStores.find(ptr);
+			if (global != globalStores.end()) {
+				worklist.append(global->second.begin(), global->second.end());
+			}
+			else if (getStructField(ptr, field)) {
+				auto stores = fieldStores.find(field);
+				if (stores != fieldStores.end()) {
+					worklist.append(stores->second.begin(), stores->second.end());
+				}
+			}
+		}
+	}
+}
+
 void PrefetcherPass::getAnalysisUsage(AnalysisUsage &AU) const {
 	AU.addRequired<TargetLibraryInfoWrapperPass>();
-	AU.addRequired<MemorySSAWrapperPass>();
-	AU.addRequired<DependenceAnalysisWrapperPass>();
+	AU.addRequired<ScalarEvolutionWrapperPass>();
 	AU.setPreservesAll();
 }
 
-bool in(llvm::SmallVectorImpl<std::string> &C, std::string E) {
-	for (std::string entry : C) {
-		if (E.find(entry) != std::string::npos) {
+// Functions selected by -func-wl-file and -func-bl-file, loaded once.
+// Each line of a list is either a name or a regular expression between
+// slashes. A name matches the mangled name of a function, or its demangled
+// name in full, without the parameters, without the scope, or without the
+// template arguments either ("ns::f<int>(int)", "ns::f<int>", "f<int>",
+// "f"); an expression is searched for in the mangled and the demangled
+// name. Names are kept in hash sets and the
+// expressions of each kind are compiled into one, so checking a function
+// does not depend on the length of the lists. Exclusions, which are the
+// whitelist lines starting with '!' and all blacklist lines, take
+// precedence; without inclusions every other function is selected.
+class FunctionFilter {
+	llvm::StringSet<> includeNames;
+	llvm::StringSet<> excludeNames;
+	std::string includePattern;
+	std::string excludePattern;
+	std::unique_ptr<llvm::Regex> includeRegex;
+	std::unique_ptr<llvm::Regex> excludeRegex;
+	bool hasIncludes = false;
+	bool hasExcludes = false;
+
+	void load(const std::string &path, bool exclude) {
+		// a whitelist that cannot be read selects nothing, as an empty one
+		hasIncludes |= !exclude;
+
+		auto buf = llvm::MemoryBuffer::getFile(path);
+		if (!buf) {
+			llvm::errs() << "prefetcher: cannot read function list " << path
+					<< ": " << buf.getError().message() << "\n";
+			return;
+		}
+
+		llvm::SmallVector<llvm::StringRef, 64> lines;
+		(*buf)->getBuffer().split(lines, '\n', -1, false);
+
+		for (llvm::StringRef line : lines) {
+			line = line.trim();
+			if (line.empty() || line.startswith("#")) {
+				continue;
+			}
+
+			bool excluded = exclude;
+			if (!exclude && line.consume_front("!")) {
+				excluded = true;
+				line = line.ltrim();
+			}
+
+			if (line.size() > 2 && line.startswith("/") && line.endswith("/")) {
+				llvm::StringRef pattern = line.drop_front().drop_back();
+				std::string error;
+				if (!llvm::Regex(pattern).isValid(error)) {
+					llvm::errs() << "prefetcher: ignoring function list entry " << line
+							<< ": " << error << "\n";
+					continue;
+				}
+
+				std::string &all = excluded ? excludePattern : includePattern;
+				all += (all.empty() ? "(" : "|(") + pattern.str() + ")";
+			}
+			else {
+				(excluded ? excludeNames : includeNames).insert(line);
+			}
+
+			hasExcludes |= excluded;
+		}
+	}
+
+	// The names a list entry can match F by. The mangled and the full
+	// demangled name come first.
+	static void getNames(const llvm::Function &F, llvm::SmallVectorImpl<std::string> &names) {
+		std::string mangled = F.getName().str();
+		names.push_back(mangled);
+
+		std::string demangled = demangle(mangled.c_str());
+		if (demangled == mangled) {
+			return;
+		}
+		names.push_back(demangled);
+
+		// cut the parameters, then the return type and the scope, skipping
+		// over template arguments
+		size_t end = demangled.size();
+		int depth = 0;
+		for (size_t i = demangled.size(); i-- > 0;) {
+			char c = demangled[i];
+			depth += (c == ')' || c == '>') - (c == '(' || c == '<');
+			if (c == '(' && depth == 0) {
+				end = i;
+				break;
+			}
+		}
+
+		size_t begin = 0;
+		size_t base = 0;
+		depth = 0;
+		for (size_t i = 0; i < end; ++i) {
+			char c = demangled[i];
+			depth += (c == '(' || c == '<') - (c == ')' || c == '>');
+			if (depth == 0 && c == ' ') {
+				begin = base = i + 1;
+			}
+			else if (depth == 0 && c == ':' && i + 1 < end && demangled[i + 1] == ':') {
+				base = i + 2;
+			}
+		}
+
+		names.push_back(demangled.substr(begin, end - begin));
+		names.push_back(demangled.substr(base, end - base));
+
+		// and the template arguments of the function: "f<int>" -> "f"
+		if (end > base && demangled[end - 1] == '>') {
+			depth = 0;
+			for (size_t i = end; i-- > base;) {
+				char c = demangled[i];
+				depth += (c == '>') - (c == '<');
+				if (c == '<' && depth == 0) {
+					names.push_back(demangled.substr(base, i - base));
+					break;
+				}
+			}
+		}
+	}
+
+	static bool matches(const llvm::StringSet<> &set, const llvm::Regex *regex,
+			llvm::ArrayRef<std::string> names) {
+		for (size_t i = 0; i < names.size(); ++i) {
+			if (set.count(names[i]) || (regex && i < 2 && regex->match(names[i]))) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	FunctionFilter(const std::string &whiteList, const std::string &blackList) {
+		if (!whiteList.empty()) {
+			load(whiteList, false);
+		}
+		if (!blackList.empty()) {
+			load(blackList, true);
+		}
+
+		if (!includePattern.empty()) {
+			includeRegex = std::make_unique<llvm::Regex>(includePattern);
+		}
+		if (!excludePattern.empty()) {
+			excludeRegex = std::make_unique<llvm::Regex>(excludePattern);
+		}
+	}
+
+	bool isSelected(const llvm::Function &F) const {
+		if (!hasIncludes && !hasExcludes) {
 			return true;
 		}
+
+		llvm::SmallVector<std::string, 5> names;
+		getNames(F, names);
+
+		if (hasExcludes && matches(excludeNames, excludeRegex.get(), names)) {
+			return false;
+		}
+
+		return !hasIncludes || matches(includeNames, includeRegex.get(), names);
 	}
-	return false;
 };
 
-bool PrefetcherPass::runOnFunction(llvm::Function &F) {
-	llvm::SmallVector<std::string, 32> FunctionWhiteList;
+bool inFunctionWhiteList(const llvm::Function &F) {
+	// loaded by the first caller, and only read afterwards
+	static const FunctionFilter filter(FunctionWhiteListFile, FunctionBlackListFile);
 
-	if (FunctionWhiteListFile.getPosition()) {
-		std::ifstream wlFile{FunctionWhiteListFile};
+	if (!filter.isSelected(F)) {
+		llvm::errs() << "skipping func: " << F.getName() << " reason: not in whitelist\n";
+		return false;
+	}
+	return true;
+}
 
-		std::string funcName;
-		while (wlFile >> funcName) {
-			FunctionWhiteList.push_back(funcName);
-		}
+// The part of the analysis that only reads the IR of F, so that functions
+// can be analysed concurrently.
+static void detectIndirections(llvm::Function &F, PrefetcherAnalysisResult &Result) {
+	if (DetectSinVal) {
+		identifyCorrectGEPDependence(F, Result.geps);
+	}
+	if (DetectRanged) {
+		identifyCorrectRangedIndirection(F, Result.ri_geps);
 	}
+}
+
+void analyzeFunction(llvm::Function &F, llvm::TargetLibraryInfo &TLI,
+		llvm::ScalarEvolution &SE, PrefetcherAnalysisResult &Result) {
+	Result.allocs.clear();
+	Result.geps.clear();
+	Result.ri_geps.clear();
 
 	if (F.isDeclaration()) {
-		return false;
+		return;
 	}
 
-	Result->allocs.clear();
-	Result->geps.clear();
-	Result->ri_geps.clear();
-	auto &TLI = getAnalysis<llvm::TargetLibraryInfoWrapperPass>().getTLI(F);
+	identifyAllocations(F, TLI, SE, Result.allocs);
+
+	if (!inFunctionWhiteList(F)) {
+		return;
+	}
+
+	detectIndirections(F, Result);
+	printGEPDependence(Result.geps);
+}
+
+void PrefetcherModuleAnalysis::run(llvm::Module &M,
+		llvm::function_ref<llvm::TargetLibraryInfo &(llvm::Function &)> getTLI,
+		llvm::function_ref<llvm::ScalarEvolution &(llvm::Function &)> getSE) {
+	results.clear();
+	results.resize(M.size());
+	index.clear();
+
+	std::vector<llvm::Function *> selected;
+	std::vector<PrefetcherAnalysisResult *> selectedResults;
+
+	unsigned i = 0;
+	for (llvm::Function &F : M) {
+		PrefetcherAnalysisResult &Result = results[i];
+		index[&F] = i++;
+
+		if (F.isDeclaration()) {
+			continue;
+		}
+
+		identifyAllocations(F, getTLI(F), getSE(F), Result.allocs);
+
+		if (inFunctionWhiteList(F)) {
+			selected.push_back(&F);
+			selectedResults.push_back(&Result);
+		}
+	}
+
+	unsigned threads = llvm::hardware_concurrency(AnalysisThreads).compute_thread_count();
+	if (threads <= 1 || selected.size() <= 1) {
+		for (i = 0; i < selected.size(); ++i) {
+			detectIndirections(*selected[i], *selectedResults[i]);
+			printGEPDependence(selectedResults[i]->geps);
+		}
+		return;
+	}
+
+	// Struct layouts, and whether a struct is sized, are computed on first
+	// use and cached in the DataLayout and the type. Compute them for all
+	// types up front, so that the workers only read them.
+	const llvm::DataLayout &DL = M.getDataLayout();
+	llvm::TypeFinder types;
+	types.run(M, false);
+	for (llvm::StructType *ST : types) {
+		if (ST->isSized()) {
+			DL.getStructLayout(ST);
+		}
+	}
+
+	llvm::ThreadPool pool(llvm::hardware_concurrency(threads));
+	for (i = 0; i < selected.size(); ++i) {
+		pool.async([&, i] {
+			detectIndirections(*selected[i], *selectedResults[i]);
+		});
+	}
+	pool.wait();
 
-	identifyNewA(F, Result->allocs);
+	// printing values goes through the module's slot tracker, so it is left
+	// to this thread and done in module order
+	for (PrefetcherAnalysisResult *Result : selectedResults) {
+		printGEPDependence(Result->geps);
+	}
+}
+
+PrefetcherAnalysisResult *PrefetcherModuleAnalysis::get(llvm::Function &F) {
+	auto found = index.find(&F);
+	assert(found != index.end() && "function not in the analysed module");
+	return &results[found->second];
+}
 
-	if (FunctionWhiteListFile.getPosition() &&
-			!in(FunctionWhiteList, F.getName().str())) {
-		llvm::errs() << "skipping func: " << F.getName() << " reason: not in whitelist\n";;
+bool PrefetcherPass::runOnFunction(llvm::Function &F) {
+	if (F.isDeclaration()) {
 		return false;
 	}
 
-	identifyCorrectGEPDependence(F, Result->geps);
-	identifyCorrectRangedIndirection(F,Result->ri_geps);
+	auto &TLI = getAnalysis<llvm::TargetLibraryInfoWrapperPass>().getTLI(F);
+
+	auto &SE = getAnalysis<llvm::ScalarEvolutionWrapperPass>().getSE();
+
+	analyzeFunction(F, TLI, SE, Result);
 
 	return false;
 }
@@ -406,4 +1215,134 @@ char PrefetcherPass::ID = 0;
 static llvm::RegisterPass<PrefetcherPass> X("prefetcher", "Prefetcher Pass",
 		false, false);
 
+llvm::AnalysisKey PrefetcherAnalysis::Key;
+
+PrefetcherAnalysis::Result PrefetcherAnalysis::run(llvm::Function &F,
+		llvm::FunctionAnalysisManager &FAM) {
+	Result result;
+
+	if (!F.isDeclaration()) {
+		analyzeFunction(F, FAM.getResult<llvm::TargetLibraryAnalysis>(F),
+				FAM.getResult<llvm::ScalarEvolutionAnalysis>(F), result);
+	}
+
+	return result;
+}
+
+void SinValIndirectionPass::getAnalysisUsage(AnalysisUsage &AU) const {
+	AU.setPreservesAll();
+}
+
+bool SinValIndirectionPass::runOnModule(Module &M) {
+	Result.geps.clear();
+
+	for (llvm::Function &F : M) {
+		if (F.isDeclaration() || !inFunctionWhiteList(F)) {
+			continue;
+		}
+
+		llvm::SmallVector<GEPDepInfo, 8> geps;
+		identifyCorrectGEPDependence(F, geps);
+		printGEPDependence(geps);
+		if (geps.empty()) {
+			continue;
+		}
+
+		NumSinValEdges += geps.size();
+		++NumSinValFunctions;
+		Result.geps[&F] = std::move(geps);
+	}
+
+	return false;
+}
+
+void SinValIndirectionPass::print(llvm::raw_ostream &OS, const llvm::Module *M) const {
+	if (!M) {
+		return;
+	}
+	for (const llvm::Function &F : *M) {
+		auto it = Result.geps.find(&F);
+		if (it == Result.geps.end()) {
+			continue;
+		}
+		OS << "function " << F.getName() << ":\n";
+		for (const GEPDepInfo &g : it->second) {
+			OS << "  source: " << *g.source << "\n";
+			OS << "  target: " << *g.target << "\n";
+		}
+	}
+}
+
+char SinValIndirectionPass::ID = 0;
+
+static llvm::RegisterPass<SinValIndirectionPass> SV("prefetcher-sinval-indirection",
+		"Prefetcher single-valued indirection analysis", false, true);
+
+void RangedIndirectionPass::getAnalysisUsage(AnalysisUsage &AU) const {
+	AU.setPreservesAll();
+}
+
+// Whether I, or a cast of it, is used by a GEP, i.e. the loaded bound
+// indexes memory.
+static bool isUsedByGEP(Instruction &I) {
+	for (llvm::User *U : I.users()) {
+		if (llvm::isa<llvm::GetElementPtrInst>(U)) {
+			return true;
+		}
+		auto *cast = llvm::dyn_cast<llvm::CastInst>(U);
+		if (cast && isUsedByGEP(*cast)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool RangedIndirectionPass::runOnModule(Module &M) {
+	Result.ri_geps.clear();
+
+	for (llvm::Function &F : M) {
+		if (F.isDeclaration() || !inFunctionWhiteList(F)) {
+			continue;
+		}
+
+		llvm::SmallVector<GEPDepInfo, 8> ri_geps;
+		identifyCorrectRangedIndirection(F, ri_geps);
+		if (ri_geps.empty()) {
+			continue;
+		}
+
+		for (const GEPDepInfo &g : ri_geps) {
+			if (isUsedByGEP(*llvm::cast<Instruction>(g.target))) {
+				++NumRangedIndexed;
+			}
+		}
+
+		NumRangedEdges += ri_geps.size();
+		++NumRangedFunctions;
+		Result.ri_geps[&F] = std::move(ri_geps);
+	}
+
+	return false;
+}
+
+void RangedIndirectionPass::print(llvm::raw_ostream &OS, const llvm::Module *M) const {
+	if (!M) {
+		return;
+	}
+	for (const llvm::Function &F : *M) {
+		auto it = Result.ri_geps.find(&F);
+		if (it == Result.ri_geps.end()) {
+			continue;
+		}
+		OS << "function " << F.getName() << ":\n";
+		for (const GEPDepInfo &g : it->second) {
+			OS << "  source: " << *g.source << "\n";
+			OS << "  target: " << *g.target << "\n";
+		}
+	}
+}
+
+char RangedIndirectionPass::ID = 0;
 
+static llvm::RegisterPass<RangedIndirectionPass> RI("prefetcher-ranged-indirection",
+		"Prefetcher ranged indirection analysis", false, true);
@@ -40,17 +40,16 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "llvm/IR/Value.h"
 
 #include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "llvm/IR/BasicBlock.h"
-#include "llvm/IR/CallSite.h"
 #include "llvm/IR/Instruction.h"
 
-#include "llvm/Analysis/DependenceAnalysis.h"
 #include "llvm/Analysis/LoopInfo.h"
-#include "llvm/Analysis/MemorySSA.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Type.h"
@@ -58,6 +57,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "llvm/ADT/SmallVector.h"
 // using llvm::SmallVector
 
+#include "llvm/ADT/DenseMap.h"
+// using llvm::DenseMap
+
+#include "llvm/ADT/SmallPtrSet.h"
+// using llvm::SmallPtrSet
+
+#include "llvm/ADT/STLExtras.h"
+// using llvm::function_ref
+
 #include "llvm/Support/Debug.h"
 // using DEBUG macro
 // using llvm::dbgs
@@ -80,26 +88,44 @@ class Instruction;
 }; // namespace llvm
 
 struct myAllocCallInfo {
-	llvm::Instruction *allocInst;
+	llvm::Instruction *allocInst = nullptr;
+	// size in bytes and element size, as passed to register_node_with_size
 	llvm::SmallVector<llvm::Value *, 3> inputArguments;
+	// the size is given as an element count (calloc) and has to be
+	// multiplied by the element size
+	bool sizeIsCount = false;
 };
 
 struct GEPDepInfo {
-	llvm::Value *source;
-	llvm::Value *target;
-	llvm::Function *funcSource;
-	llvm::Function *funcTarget;
-	llvm::Instruction * source_use;
-	llvm::Instruction * load_to_copy;
-	llvm::Instruction * phi_node;
+	llvm::Value *source = nullptr;
+	llvm::Value *target = nullptr;
+	llvm::Function *funcSource = nullptr;
+	llvm::Function *funcTarget = nullptr;
+	llvm::Instruction * source_use = nullptr;
+	llvm::Instruction * load_to_copy = nullptr;
+	llvm::Instruction * phi_node = nullptr;
+	// GEPs that compute the source and target addresses of the edge
+	llvm::Instruction * source_gep = nullptr;
+	llvm::Instruction * target_gep = nullptr;
 	bool phi = false;
+	// position of the edge in its indirection chain (0 for the edge leaving
+	// the trigger node) and number of edges from here to the end of the chain
+	unsigned level = 0;
+	unsigned chain_length = 1;
+	// set for array-of-structs edges: the loaded index selects an element of
+	// stride bytes of the target, and the edge follows the field
+	// field_offset bytes into that element
+	bool field = false;
+	uint64_t field_offset = 0;
+	uint64_t stride = 0;
 
 	bool operator<(const GEPDepInfo &Other) const {
 		return source < Other.source && target < Other.target;
 	}
 
 	bool operator==(const GEPDepInfo &Other) const {
-		return (source == Other.source && target == Other.target);
+		return (source == Other.source && target == Other.target &&
+				field_offset == Other.field_offset);
 	}
 };
 
@@ -122,32 +148,95 @@ template <typename T> void printVector(std::string inStr, T begin, T end) {
 	errs() << ">\n";
 }
 
+// Runs the indirection detection on a single function and fills in Result.
+// Shared by the legacy and the new pass manager analyses.
+void analyzeFunction(llvm::Function &F, llvm::TargetLibraryInfo &TLI,
+		llvm::ScalarEvolution &SE, PrefetcherAnalysisResult &Result);
+
+// Analysis results of every function of a module, computed at once for the
+// legacy pass manager, which would otherwise rerun PrefetcherPass on each
+// request (the new pass manager caches PrefetcherAnalysis instead). The
+// allocations are identified one function at a time, since ScalarEvolution
+// and the constants it creates are not thread safe. The indirection
+// detection only reads the IR, so it runs on -prefetcher-analysis-threads
+// threads with one result per function. Results are kept in module order,
+// so the codegen sees the same edges for any number of threads.
+class PrefetcherModuleAnalysis {
+	std::vector<PrefetcherAnalysisResult> results;
+	llvm::DenseMap<const llvm::Function *, unsigned> index;
+
+public:
+	void run(llvm::Module &M,
+			llvm::function_ref<llvm::TargetLibraryInfo &(llvm::Function &)> getTLI,
+			llvm::function_ref<llvm::ScalarEvolution &(llvm::Function &)> getSE);
+
+	// Result for F, which must be a function of the analysed module.
+	PrefetcherAnalysisResult *get(llvm::Function &F);
+};
+
+// Follows a pointer back to the values it may have been derived from,
+// across call arguments, return values, globals and struct fields of the
+// whole module. Used to find the allocation a DIG node was created from
+// when it is traversed in another function, or in another translation
+// unit once the module is linked (-prefetcher-lto).
+class AllocationOrigins {
+	// values stored to each (struct type, field index) pair
+	llvm::DenseMap<std::pair<llvm::Type *, unsigned>,
+		llvm::SmallVector<llvm::Value *, 4>> fieldStores;
+	// values stored to each global variable
+	llvm::DenseMap<llvm::Value *, llvm::SmallVector<llvm::Value *, 4>> globalStores;
+
+public:
+	explicit AllocationOrigins(llvm::Module &M);
+
+	// Adds every value V may be derived from, including V, to origins.
+	void find(llvm::Value *V, llvm::SmallPtrSetImpl<llvm::Value *> &origins) const;
+};
+
 class PrefetcherPass : public llvm::FunctionPass {
 public:
 	static char ID;
 
 	using ResultT = PrefetcherAnalysisResult;
 
-	ResultT * Result;
-
-	PrefetcherPass() : llvm::FunctionPass(ID) {Result = new ResultT();}
+	ResultT Result;
 
-	~PrefetcherPass(){delete Result;}
+	PrefetcherPass() : llvm::FunctionPass(ID) {}
 
-	const ResultT *getPFA() const { return Result; }
+	const ResultT *getPFA() const { return &Result; }
 
-	ResultT *getPFA() { return Result; }
+	ResultT *getPFA() { return &Result; }
 
 	virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
 	bool runOnFunction(llvm::Function &F) override;
 };
 
+// New pass manager version of PrefetcherPass. Results are cached by the
+// FunctionAnalysisManager and invalidated whenever the function changes.
+class PrefetcherAnalysis : public llvm::AnalysisInfoMixin<PrefetcherAnalysis> {
+	friend llvm::AnalysisInfoMixin<PrefetcherAnalysis>;
+
+	static llvm::AnalysisKey Key;
+
+public:
+	using Result = PrefetcherAnalysisResult;
+
+	Result run(llvm::Function &F, llvm::FunctionAnalysisManager &FAM);
+};
+
+// Single-valued indirections (A[B[i]]) of every function in the module.
+struct SinValIndirectionResult {
+	llvm::DenseMap<const llvm::Function *, llvm::SmallVector<GEPDepInfo, 8>> geps;
+};
+
+// Module-wide detection of single-valued indirection only, for when the
+// ranged pattern is not wanted. Registered as -prefetcher-sinval-indirection.
 class SinValIndirectionPass : public llvm::ModulePass {
 public:
 	static char ID;
 
-	using ResultT = PrefetcherAnalysisResult;
+	using ResultT = SinValIndirectionResult;
 
 	ResultT Result;
 
@@ -160,16 +249,35 @@ public:
 	virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
 
 	bool runOnModule(Module &M) override;
+
+	void print(llvm::raw_ostream &OS, const llvm::Module *M) const override;
+};
+
+// Ranged indirections (A[B[i]..B[i+1]]) of every function in the module.
+struct RangedIndirectionResult {
+	llvm::DenseMap<const llvm::Function *, llvm::SmallVector<GEPDepInfo, 8>> ri_geps;
 };
 
+// Module-wide detection of ranged indirection only, for when the
+// single-valued pattern is not wanted. Registered as
+// -prefetcher-ranged-indirection.
 struct RangedIndirectionPass : public ModulePass {
-  static char ID;
-  RangedIndirectionPass() : ModulePass(ID) {}
+	static char ID;
 
-  bool runOnModule(Module &M) override;
+	using ResultT = RangedIndirectionResult;
+
+	ResultT Result;
+
+	const ResultT &getPFA() const { return Result; }
+
+	ResultT &getPFA() { return Result; }
+
+	RangedIndirectionPass() : ModulePass(ID) {}
+
+	bool runOnModule(Module &M) override;
 
-  virtual void getAnalysisUsage(AnalysisUsage &AU) const override;
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const override;
 
-  bool getUserFromInstrTypeRI(Instruction &I, std::vector<Instruction *> &uses, const char *InstrType);
+	void print(llvm::raw_ostream &OS, const llvm::Module *M) const override;
 };
 #endif // PREFETCHER_HPP_
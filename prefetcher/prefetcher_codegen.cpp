@@ -53,19 +53,46 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "llvm/IR/LegacyPassManager.h"
 // using llvm::PassManagerBase
 
+#include "llvm/IR/Intrinsics.h"
+// using llvm::Intrinsic::getDeclaration
+
 #include "llvm/Analysis/LoopInfo.h"
 // using llvm::LoopInfoWrapperPass
 // using llvm::LoopInfo
 // using llvm::Loop
 
+#include "llvm/Analysis/ScalarEvolution.h"
+// using llvm::ScalarEvolutionWrapperPass
+// using llvm::ScalarEvolution
+
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+// using llvm::SCEVAddRecExpr
+// using llvm::SCEVConstant
+
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+// using llvm::BlockFrequencyInfoWrapperPass
+// using llvm::BlockFrequencyInfo
+
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 // using llvm::PassManagerBuilder
 // using llvm::RegisterStandardPasses
 
+#include "llvm/Passes/PassBuilder.h"
+// using llvm::PassBuilder
+
+#include "llvm/Passes/PassPlugin.h"
+// using llvm::PassPluginLibraryInfo
+
+#include "llvm/Config/llvm-config.h"
+// using LLVM_VERSION_STRING
+
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/SmallSet.h"
 // using llvm::SmallVector
 
+#include "llvm/ADT/DenseMap.h"
+// using llvm::DenseMap
+
 #include "llvm/Support/CommandLine.h"
 // using llvm::cl::opt
 // using llvm::cl::list
@@ -76,6 +103,19 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "llvm/Support/raw_ostream.h"
 // using llvm::raw_ostream
+#include "llvm/Support/Format.h"
+// using llvm::format_hex_no_prefix
+
+#include "llvm/Support/MemoryBuffer.h"
+// using llvm::MemoryBuffer
+
+#include "llvm/Support/xxhash.h"
+// using llvm::xxHash64
+#include "llvm/Support/FileSystem.h"
+// using llvm::sys::fs::OF_Text
+#include "llvm/IR/DebugInfoMetadata.h"
+// using llvm::DILocation
+// using llvm::DISubprogram
 
 #include "llvm/Support/Debug.h"
 // using DEBUG macro
@@ -87,12 +127,24 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 // using std::string
 
+#include <map>
+// using std::map
+
+#include <set>
+// using std::set
+
+#include <functional>
+// using std::function
+
 #include "llvm/IR/Dominators.h"
 // dominator tree
 
 #include "llvm/Analysis/CFG.h"
 // isPotentiallyReachable Function
 
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+// using llvm::appendToGlobalCtors
+
 #include "prefetcher.hpp"
 
 #define DEBUG_TYPE "prefetcher-codegen"
@@ -101,6 +153,110 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define DEBUG 1
 
+enum class PrefetcherCodegenMode {
+	// register the DIG with the prefetcher runtime
+	Runtime,
+	// lower the DIG to software prefetches
+	SoftwarePrefetch,
+	// collect the DIG in a table registered with one runtime call per module
+	BatchedRuntime,
+	// instrument candidate edges to collect an edge profile
+	Profile
+};
+
+llvm::cl::opt<PrefetcherCodegenMode> CodegenMode(
+		"prefetcher-codegen-mode", llvm::cl::Hidden,
+		llvm::cl::desc("prefetcher codegen mode"),
+		llvm::cl::values(
+				clEnumValN(PrefetcherCodegenMode::Runtime, "runtime",
+						"register the DIG with the prefetcher runtime"),
+				clEnumValN(PrefetcherCodegenMode::SoftwarePrefetch, "swpf",
+						"emit llvm.prefetch for indirect accesses"),
+				clEnumValN(PrefetcherCodegenMode::BatchedRuntime, "runtime-batched",
+						"register the DIG with the prefetcher runtime as one table. "
+						"An entry holds the last instance of its site, so sites in "
+						"loops or in functions that may run more than once are "
+						"registered with a call instead"),
+				clEnumValN(PrefetcherCodegenMode::Profile, "profile",
+						"instrument candidate edges to collect an edge profile")),
+		llvm::cl::init(PrefetcherCodegenMode::Runtime));
+
+llvm::cl::opt<unsigned> SWPrefetchDistance(
+		"prefetcher-swpf-distance", llvm::cl::Hidden,
+		llvm::cl::desc("software prefetch lookahead distance in loop iterations "
+				"(computed per edge when not given)"),
+		llvm::cl::init(32));
+
+llvm::cl::opt<unsigned> PrefetchLatency(
+		"prefetcher-mem-latency", llvm::cl::Hidden,
+		llvm::cl::desc("memory latency in cycles assumed by the lookahead model"),
+		llvm::cl::init(200));
+
+llvm::cl::opt<bool> PrefetcherLTO(
+		"prefetcher-lto", llvm::cl::Hidden,
+		llvm::cl::desc("run the prefetcher codegen at link time on the whole "
+				"program instead of on each translation unit"),
+		llvm::cl::init(false));
+
+llvm::cl::opt<std::string> EdgeProfileFile(
+		"prefetcher-edge-profile", llvm::cl::Hidden,
+		llvm::cl::desc("edge profile collected with -prefetcher-codegen-mode=profile; "
+				"only the profitable edges are emitted"),
+		llvm::cl::value_desc("filename"));
+
+llvm::cl::opt<unsigned> EdgeProfileMinMisses(
+		"prefetcher-edge-min-misses", llvm::cl::Hidden,
+		llvm::cl::desc("minimum number of profiled misses of a profitable edge"),
+		llvm::cl::init(64));
+
+llvm::cl::opt<unsigned> EdgeProfileMinMissPercent(
+		"prefetcher-edge-min-miss-percent", llvm::cl::Hidden,
+		llvm::cl::desc("minimum percentage of the profiled accesses of a "
+				"profitable edge that miss"),
+		llvm::cl::init(10));
+
+llvm::cl::opt<bool> TriggerHooks(
+		"prefetcher-trigger-hooks", llvm::cl::Hidden,
+		llvm::cl::desc("call the runtime before every access to a trigger node, "
+				"for runtimes that prefetch in software"),
+		llvm::cl::init(false));
+
+llvm::cl::opt<unsigned> MaxThreads(
+		"prefetcher-max-threads", llvm::cl::Hidden,
+		llvm::cl::desc("threads per parallel region that the DIG capacity is "
+				"sized for"),
+		llvm::cl::init(64));
+
+llvm::cl::opt<bool> HotLoops(
+		"prefetcher-hot-loops", llvm::cl::Hidden,
+		llvm::cl::desc("only emit edges whose source access is in a hot loop, "
+				"and the nodes they reach"),
+		llvm::cl::init(false));
+
+llvm::cl::opt<unsigned> HotLoopMinDepth(
+		"prefetcher-hot-loop-depth", llvm::cl::Hidden,
+		llvm::cl::desc("minimum loop depth of the source access of a hot edge"),
+		llvm::cl::init(1));
+
+llvm::cl::opt<unsigned> HotLoopMinFreq(
+		"prefetcher-hot-loop-freq", llvm::cl::Hidden,
+		llvm::cl::desc("minimum executions of the source access of a hot edge "
+				"per call of its function, by block frequency"),
+		llvm::cl::init(8));
+
+llvm::cl::opt<unsigned long long> HotLoopMinCount(
+		"prefetcher-hot-loop-count", llvm::cl::Hidden,
+		llvm::cl::desc("minimum profiled executions of the source access of a hot "
+				"edge, in functions with an instrumentation or sample profile"),
+		llvm::cl::init(0));
+
+llvm::cl::opt<std::string> IdMapFile(
+		"prefetcher-id-map", llvm::cl::Hidden,
+		llvm::cl::desc("file the stable key of every node and edge id is written to; "
+				"not written by default. The build must pass a path per object "
+				"file, e.g. the object path with a .pfmap extension"),
+		llvm::cl::value_desc("filename"));
+
 namespace {
 
 struct PrefetcherRuntime {
@@ -110,12 +266,15 @@ struct PrefetcherRuntime {
 	static constexpr char *RegisterIdentifyEdgeSource = "register_identify_edge_source";
 	static constexpr char *RegisterIdentifyEdgeTarget = "register_identify_edge_target";
 	static constexpr char *RegisterIdentifyEdge = "register_identify_edge";
+	static constexpr char *RegisterIdentifyEdgeTable = "register_identify_edge_table";
 	static constexpr char *RegisterNodeWithSize = "register_node_with_size";
 	static constexpr char *RegisterTravEdge1 = "register_trav_edge1";
 	static constexpr char *RegisterTravEdge2 = "register_trav_edge2";
 	static constexpr char *RegisterTrigEdge1 = "register_trig_edge1";
 	static constexpr char *RegisterTrigEdge2 = "register_trig_edge2";
+	static constexpr char *RegisterTrigEdgeRange = "register_trig_edge_range";
 	static constexpr char *SimUserPfSetParam = "sim_user_pf_set_param";
+	static constexpr char *SimUserPfUpdate = "sim_user_pf_update";
 	static constexpr char *SimUserPfSetEnable = "sim_user_pf_set_enable";
 	static constexpr char *SimUserPfEnable = "sim_user_pf_enable";
 	static constexpr char *SimUserWait = "sim_user_wait";
@@ -124,6 +283,9 @@ struct PrefetcherRuntime {
 	static constexpr char *SimUserPfDisable = "sim_user_pf_disable";
 	static constexpr char *DeleteParams = "delete_params";
 	static constexpr char *DeleteEnable = "delete_enable";
+	static constexpr char *RegisterDigBatch = "register_dig_batch";
+	static constexpr char *RegisterFieldView = "register_field_view";
+	static constexpr char *TriggerAccess = "pf_trigger_access";
 
 	static const std::vector<std::string> Functions;
 };
@@ -134,13 +296,16 @@ const std::vector<std::string> PrefetcherRuntime::Functions = {
 		PrefetcherRuntime::RegisterIdentifyEdge,
 		PrefetcherRuntime::RegisterIdentifyEdgeSource,
 		PrefetcherRuntime::RegisterIdentifyEdgeTarget,
+		PrefetcherRuntime::RegisterIdentifyEdgeTable,
 		PrefetcherRuntime::RegisterNode,
 		PrefetcherRuntime::RegisterNodeWithSize,
 		PrefetcherRuntime::RegisterTravEdge1,
 		PrefetcherRuntime::RegisterTravEdge2,
 		PrefetcherRuntime::RegisterTrigEdge1,
 		PrefetcherRuntime::RegisterTrigEdge2,
+		PrefetcherRuntime::RegisterTrigEdgeRange,
 		PrefetcherRuntime::SimUserPfSetParam,
+		PrefetcherRuntime::SimUserPfUpdate,
 		PrefetcherRuntime::SimUserPfSetEnable,
 		PrefetcherRuntime::SimUserPfEnable,
 		PrefetcherRuntime::SimUserWait,
@@ -148,7 +313,10 @@ const std::vector<std::string> PrefetcherRuntime::Functions = {
 		PrefetcherRuntime::SimRoiEnd,
 		PrefetcherRuntime::SimUserPfDisable,
 		PrefetcherRuntime::DeleteParams,
-		PrefetcherRuntime::DeleteEnable};
+		PrefetcherRuntime::DeleteEnable,
+		PrefetcherRuntime::RegisterDigBatch,
+		PrefetcherRuntime::RegisterFieldView,
+		PrefetcherRuntime::TriggerAccess};
 
 enum FuncId {
 	// traversal functions registered
@@ -173,21 +341,479 @@ enum FuncId {
 	InvalidFuncId
 };
 
+// Kind of an entry of the DIG table passed to register_dig_batch. Must be
+// kept in sync with pf_dig_desc_kind_t in the runtime.
+enum DIGDescKind {
+	DIGDescNode = 1,
+	DIGDescTravEdge,
+	DIGDescTrigEdge,
+	DIGDescFieldView
+};
+
+// Number of i64 fields of a DIG table entry: the kind and up to four
+// registration arguments.
+constexpr unsigned DIGDescFields = 5;
+
 class PrefetcherCodegen {
 	llvm::Module *Mod;
 	llvm::LoopInfo *LI;
-	unsigned long NodeCount;
+	llvm::ScalarEvolution *SE;
+	llvm::BlockFrequencyInfo *BFI;
 	unsigned long TriggerEdgeCount;
 
+	// layout position of each block of the function currently being ordered
+	llvm::DenseMap<const llvm::BasicBlock *, unsigned> blockOrder;
+	const llvm::Function *orderedFunc;
+
+	// DIG table entries collected in batched mode. Dynamic fields are stored
+	// at the registration site into a placeholder, which is replaced by the
+	// table once its size is known.
+	llvm::SmallVector<llvm::Constant *, 32> digDescs;
+	llvm::GlobalVariable *digTablePlaceholder;
+
+	// maps trigger sources to the allocations they were derived from
+	const AllocationOrigins *allocOrigins;
+
+	// node id of the field view registered for each (target, field offset)
+	std::map<std::pair<llvm::Value *, uint64_t>, int64_t> fieldViews;
+
+	// counters of each edge read from -prefetcher-edge-profile, by edge id
+	struct EdgeProfileEntry {
+		uint64_t exercised;
+		uint64_t accesses;
+		uint64_t misses;
+	};
+	std::map<uint64_t, EdgeProfileEntry> edgeProfile;
+	bool edgeProfileLoaded = false;
+
+	// keys of the edges instrumented in profile mode, by edge index, and the
+	// index the runtime gives the first of them
+	llvm::SmallVector<uint64_t, 32> profiledEdges;
+	llvm::GlobalVariable *edgeIndexBase = nullptr;
+
+	// order of each instruction among those at the same source location, or
+	// in its function if it has none, taken before any code is emitted
+	llvm::DenseMap<const llvm::Instruction *, unsigned> siteOrder;
+
+	// stable key of every node and edge id handed out, for -prefetcher-id-map
+	struct IdMapEntry {
+		const char *kind;
+		int64_t id;
+		uint64_t key;
+		std::string func;
+		std::string loc;
+	};
+	std::vector<IdMapEntry> idMap;
+
 public:
 	llvm::SmallPtrSet<llvm::Value *, 4> emittedNodes;
 	llvm::SmallSet<struct GEPDepInfo, 4> emittedTravEdges;
 	llvm::SmallPtrSet<llvm::Value *, 4> emittedTrigEdges;
 	std::map<llvm::Value *, llvm::Instruction *> insertPts;
-	unsigned int edgeCount = 0;
+	unsigned int fieldViewCount = 0;
+	// trigger edges bounded to the iterations of one thread, and the
+	// traversal edges of their nodes, which the runtime copies per thread
+	unsigned int rangeTriggerCount = 0;
+	unsigned int rangeTravEdgeCount = 0;
 
 	PrefetcherCodegen(llvm::Module &M)
-	: Mod(&M), LI(nullptr), NodeCount(0), TriggerEdgeCount(0){};
+	: Mod(&M), LI(nullptr), SE(nullptr), BFI(nullptr), TriggerEdgeCount(0),
+	  orderedFunc(nullptr), digTablePlaceholder(nullptr), allocOrigins(nullptr){};
+
+	void setAllocationOrigins(const AllocationOrigins *origins) {
+		allocOrigins = origins;
+	}
+
+	// Numbers the instructions of F for getSiteKey(). Has to run before any
+	// code is emitted into F, so that emitted code does not shift the
+	// numbers.
+	void numberSites(llvm::Function &F) {
+		std::map<std::pair<unsigned, unsigned>, unsigned> atLocation;
+		unsigned index = 0;
+
+		for (llvm::BasicBlock &BB : F) {
+			for (llvm::Instruction &I : BB) {
+				if (const llvm::DILocation *DL = I.getDebugLoc().get()) {
+					siteOrder[&I] = atLocation[{DL->getLine(), DL->getColumn()}]++;
+				}
+				else {
+					siteOrder[&I] = index;
+				}
+				++index;
+			}
+		}
+	}
+
+	// Position of I in its function that stays the same when code elsewhere
+	// moves: its source line relative to the start of the function, its
+	// column, and its order among the instructions at that location.
+	// Without a debug location it is the index of I in the function, which
+	// only stays the same while the function does.
+	std::string getSiteKey(const llvm::Instruction *I) {
+		unsigned order = siteOrder.lookup(I);
+
+		const llvm::DILocation *DL = I->getDebugLoc().get();
+		if (!DL) {
+			return ("@" + llvm::Twine(order)).str();
+		}
+
+		unsigned line = DL->getLine();
+		if (auto *SP = DL->getScope()->getSubprogram()) {
+			line -= std::min(line, SP->getLine());
+		}
+		return (llvm::Twine(line) + ":" + llvm::Twine(DL->getColumn()) + "#" +
+				llvm::Twine(order)).str();
+	}
+
+	// Key of an edge made from its function and the sites of its source and
+	// target accesses, so it stays the same between the profiling and the
+	// profile-guided compilation however the analysis orders the edges.
+	uint64_t getEdgeKey(const GEPDepInfo &gdi) {
+		auto *source = dyn_cast_or_null<llvm::Instruction>(gdi.source_use ? gdi.source_use : gdi.source_gep);
+		auto *target = dyn_cast_or_null<llvm::Instruction>(gdi.target_gep ? gdi.target_gep : gdi.target);
+		if (!source || !target) {
+			return 0;
+		}
+
+		return llvm::xxHash64(("edge#" + source->getFunction()->getName() + "#" +
+				getSiteKey(source) + "#" + getSiteKey(target)).str());
+	}
+
+	// Key of a node made from its kind, its function, its site and detail
+	// (e.g. the allocation function), which stays the same when code moves
+	// around the function, as the keys of edges do.
+	uint64_t getNodeKey(const char *kind, const llvm::Instruction *site, llvm::StringRef detail) {
+		return llvm::xxHash64((llvm::Twine(kind) + "#" + site->getFunction()->getName() + "#" +
+				detail + "#" + getSiteKey(site)).str());
+	}
+
+	// Id of a node registered with the runtime: its key, kept below 2^62 so
+	// that the ids the runtime gives to nodes it adds above them stay
+	// positive. Snapshots refer to nodes by it.
+	static int64_t getNodeId(uint64_t key) {
+		return key & ((uint64_t(1) << 62) - 1);
+	}
+
+	// Id of a traversal edge registered with the runtime, which takes an
+	// int: the low bits of its key.
+	static int32_t getTravEdgeId(uint64_t key) {
+		return key & INT32_MAX;
+	}
+
+	// Records id and the key it was derived from for -prefetcher-id-map,
+	// with the source location of site.
+	void recordId(const char *kind, int64_t id, uint64_t key, const llvm::Instruction *site) {
+		IdMapEntry e = {kind, id, key, site->getFunction()->getName().str(), "-"};
+
+		if (const llvm::DILocation *DL = site->getDebugLoc().get()) {
+			e.loc = (DL->getFilename() + ":" + llvm::Twine(DL->getLine()) + ":" +
+					llvm::Twine(DL->getColumn())).str();
+		}
+
+		idMap.push_back(std::move(e));
+	}
+
+	// Writes the id map to -prefetcher-id-map, one "kind id key function
+	// location" line per node and edge. The key is in hex; for edges it is
+	// the id of the edge in the edge profile. The pass does not know the
+	// object file, so there is no default path that could not be shared
+	// with other translation units.
+	void writeIdMap() {
+		if (IdMapFile.empty()) {
+			return;
+		}
+
+		const std::string &path = IdMapFile;
+		std::error_code EC;
+		llvm::raw_fd_ostream OS(path, EC, llvm::sys::fs::OF_Text);
+		if (EC) {
+			llvm::errs() << "prefetcher: cannot write id map " << path << ": "
+					<< EC.message() << "\n";
+			return;
+		}
+
+		OS << "# kind id key function location\n";
+		for (const IdMapEntry &e : idMap) {
+			OS << e.kind << " " << e.id << " " << llvm::format_hex_no_prefix(e.key, 16)
+					<< " " << e.func << " " << e.loc << "\n";
+		}
+	}
+
+	void loadEdgeProfile() {
+		auto buf = llvm::MemoryBuffer::getFile(EdgeProfileFile);
+		if (!buf) {
+			llvm::errs() << "prefetcher: cannot read edge profile " << EdgeProfileFile
+					<< ": " << buf.getError().message() << ", emitting all edges\n";
+			return;
+		}
+
+		llvm::SmallVector<llvm::StringRef, 64> lines;
+		(*buf)->getBuffer().split(lines, '\n', -1, false);
+
+		for (llvm::StringRef line : lines) {
+			line = line.trim();
+			if (line.empty() || line.startswith("#")) {
+				continue;
+			}
+
+			llvm::SmallVector<llvm::StringRef, 4> fields;
+			line.split(fields, ' ', -1, false);
+
+			uint64_t id;
+			EdgeProfileEntry e;
+			if (fields.size() != 4 || fields[0].getAsInteger(16, id) ||
+					fields[1].getAsInteger(10, e.exercised) ||
+					fields[2].getAsInteger(10, e.accesses) ||
+					fields[3].getAsInteger(10, e.misses)) {
+				continue;
+			}
+
+			edgeProfile[id] = e;
+		}
+
+		edgeProfileLoaded = true;
+	}
+
+	// An edge is worth emitting if it covers enough misses, both in number
+	// and as a share of its accesses. Edges missing from the profile were
+	// never executed. Without a profile every edge is emitted.
+	bool isProfitableEdge(uint64_t id) {
+		if (!edgeProfileLoaded) {
+			return true;
+		}
+
+		auto found = edgeProfile.find(id);
+		if (found == edgeProfile.end()) {
+			return false;
+		}
+
+		const EdgeProfileEntry &e = found->second;
+		return e.misses >= EdgeProfileMinMisses &&
+			e.misses * 100 >= e.accesses * EdgeProfileMinMissPercent;
+	}
+
+	void getProfitableEdges(llvm::SmallVectorImpl<GEPDepInfo> &geps,
+			llvm::SmallVectorImpl<GEPDepInfo> &profitable) {
+		for (unsigned i = 0; i < geps.size(); ++i) {
+			if (isProfitableEdge(getEdgeKey(geps[i]))) {
+				profitable.push_back(geps[i]);
+			}
+#if DEBUG == 1
+			else {
+				errs() << "Skip unprofitable edge: " << *geps[i].target << "\n";
+			}
+#endif
+		}
+	}
+
+	// Load through the target GEP of an edge, if there is one.
+	llvm::LoadInst *getTargetLoad(llvm::Instruction *target_gep) {
+		for (llvm::User *U : target_gep->users()) {
+			if (auto *ld = dyn_cast<llvm::LoadInst>(U)) {
+				return ld;
+			}
+			if (auto *cast = dyn_cast<llvm::BitCastInst>(U)) {
+				for (llvm::User *CU : cast->users()) {
+					if (auto *ld = dyn_cast<llvm::LoadInst>(CU)) {
+						return ld;
+					}
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	// Instruments an edge for -prefetcher-codegen-mode=profile: the
+	// executions of its source and target loads are counted under the next
+	// edge index of the module. The key has to be taken before any code is
+	// emitted into the function.
+	bool emitEdgeProfile(GEPDepInfo &gdi, uint64_t key) {
+		auto *ld = dyn_cast_or_null<llvm::LoadInst>(gdi.source_use);
+		llvm::LoadInst *target_ld = gdi.target_gep ? getTargetLoad(gdi.target_gep) : nullptr;
+
+		if (!ld || !target_ld) {
+			return false;
+		}
+
+		auto *i64Ty = llvm::Type::getInt64Ty(Mod->getContext());
+		if (!edgeIndexBase) {
+			edgeIndexBase = new llvm::GlobalVariable(*Mod, i64Ty, false,
+					llvm::GlobalValue::InternalLinkage, llvm::ConstantInt::get(i64Ty, 0),
+					"__prefetcher_edge_index_base");
+		}
+
+		unsigned index = profiledEdges.size();
+		profiledEdges.push_back(key);
+
+		auto emitHook = [&](const char *hook, llvm::LoadInst *access) {
+			llvm::IRBuilder<> Builder(access);
+			llvm::Value *edgeIndex = Builder.CreateAdd(
+					Builder.CreateLoad(i64Ty, edgeIndexBase), Builder.getInt64(index));
+			Builder.CreateCall(Mod->getFunction(hook), {access->getPointerOperand(), edgeIndex});
+		};
+
+		emitHook(PrefetcherRuntime::RegisterIdentifyEdgeSource, ld);
+		emitHook(PrefetcherRuntime::RegisterIdentifyEdgeTarget, target_ld);
+
+		return true;
+	}
+
+	// Registers the keys of the edges instrumented in profile mode with the
+	// runtime from a module constructor, which sets the index of the first.
+	void emitEdgeProfileTable() {
+		if (profiledEdges.empty()) {
+			return;
+		}
+
+		auto *keys = llvm::ConstantDataArray::get(Mod->getContext(),
+				llvm::ArrayRef<uint64_t>(profiledEdges));
+		auto *table = new llvm::GlobalVariable(*Mod, keys->getType(), true,
+				llvm::GlobalValue::InternalLinkage, keys, "__prefetcher_edge_keys");
+
+		llvm::Constant *idx[] = {
+				llvm::ConstantInt::get(llvm::Type::getInt64Ty(Mod->getContext()), 0),
+				llvm::ConstantInt::get(llvm::Type::getInt64Ty(Mod->getContext()), 0)};
+		auto *first = llvm::ConstantExpr::getGetElementPtr(keys->getType(), table, idx);
+
+		auto *ctor = llvm::Function::Create(
+				llvm::FunctionType::get(llvm::Type::getVoidTy(Mod->getContext()), false),
+				llvm::GlobalValue::InternalLinkage, "__prefetcher_register_edge_keys", Mod);
+		llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Mod->getContext(), "entry", ctor));
+
+		Builder.CreateCall(Mod->getFunction(PrefetcherRuntime::RegisterIdentifyEdgeTable),
+				{first, Builder.getInt64(profiledEdges.size()), edgeIndexBase});
+		Builder.CreateRetVoid();
+
+		llvm::appendToGlobalCtors(*Mod, ctor, 0);
+	}
+
+	llvm::StructType *getDIGDescType() {
+		auto *i64Ty = llvm::Type::getInt64Ty(Mod->getContext());
+		llvm::SmallVector<llvm::Type *, DIGDescFields> fields(DIGDescFields, i64Ty);
+
+		return llvm::StructType::get(Mod->getContext(), fields);
+	}
+
+	// Whether the code at I runs at most once per program run: it is not in
+	// a cycle, and is in main or in a local function whose only use is a
+	// call that runs once. Cycles too large to rule out, and call chains
+	// deeper than a few functions, are taken to run more than once.
+	bool runsOnce(llvm::Instruction *I, unsigned depth = 0) {
+		llvm::Function *F = I->getFunction();
+		if (F->getName() != "main") {
+			if (depth >= 4 || !F->hasLocalLinkage() || !F->hasOneUse()) {
+				return false;
+			}
+			auto *CB = llvm::dyn_cast<llvm::CallBase>(F->user_back());
+			if (!CB || CB->getCalledOperand() != F || !runsOnce(CB, depth + 1)) {
+				return false;
+			}
+		}
+
+		llvm::BasicBlock *BB = I->getParent();
+		for (llvm::BasicBlock *succ : llvm::successors(BB)) {
+			if (llvm::isPotentiallyReachable(succ, BB)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Emits a registration with the runtime before insertPt. In batched mode
+	// the constant arguments go into a new DIG table entry and the others are
+	// stored into it, so no call is made. An entry only holds the last
+	// registration made at its site, and is stored without synchronisation,
+	// so sites that may run more than once are still called. Returns the
+	// last emitted instruction.
+	llvm::Instruction *emitRegistration(llvm::Function *func, DIGDescKind kind,
+			llvm::ArrayRef<llvm::Value *> args, llvm::Instruction *insertPt) {
+		if (CodegenMode != PrefetcherCodegenMode::BatchedRuntime || !runsOnce(insertPt)) {
+			return llvm::CallInst::Create(func, args, "", insertPt);
+		}
+
+		auto *descTy = getDIGDescType();
+		auto *i64Ty = llvm::Type::getInt64Ty(Mod->getContext());
+
+		if (!digTablePlaceholder) {
+			digTablePlaceholder = new llvm::GlobalVariable(*Mod, descTy, false,
+					llvm::GlobalValue::ExternalLinkage, nullptr, "__prefetcher_dig_table.tmp");
+		}
+
+		llvm::IRBuilder<> Builder(insertPt);
+		llvm::SmallVector<llvm::Constant *, DIGDescFields> fields;
+		llvm::Instruction *last = nullptr;
+		unsigned slot = digDescs.size();
+
+		fields.push_back(llvm::ConstantInt::get(i64Ty, kind));
+
+		for (unsigned i = 0; i < DIGDescFields - 1; ++i) {
+			llvm::Value *arg = i < args.size() ? args[i] : nullptr;
+
+			if (auto *c = dyn_cast_or_null<llvm::ConstantInt>(arg)) {
+				fields.push_back(llvm::ConstantInt::get(i64Ty, c->getSExtValue()));
+				continue;
+			}
+
+			fields.push_back(llvm::ConstantInt::get(i64Ty, 0));
+
+			if (!arg) {
+				continue;
+			}
+
+			llvm::Value *val = nullptr;
+			if (arg->getType()->isPointerTy()) {
+				val = Builder.CreatePtrToInt(arg, i64Ty);
+			}
+			else if (arg->getType()->isIntegerTy()) {
+				val = Builder.CreateZExtOrTrunc(arg, i64Ty);
+			}
+			else {
+				val = Builder.CreateBitOrPointerCast(arg, i64Ty);
+			}
+
+			llvm::Value *idx[] = {Builder.getInt64(slot), Builder.getInt32(i + 1)};
+			auto *field = llvm::ConstantExpr::getGetElementPtr(descTy, digTablePlaceholder, idx);
+			last = Builder.CreateStore(val, field);
+		}
+
+		digDescs.push_back(llvm::ConstantStruct::get(descTy, fields));
+
+		return last ? last : insertPt->getPrevNode();
+	}
+
+	// Creates the DIG table collected in batched mode and registers it with
+	// the runtime from a module constructor.
+	void emitDIGTable() {
+		if (!digTablePlaceholder) {
+			return;
+		}
+
+		auto *descTy = getDIGDescType();
+		auto *tableTy = llvm::ArrayType::get(descTy, digDescs.size());
+		auto *table = new llvm::GlobalVariable(*Mod, tableTy, false,
+				llvm::GlobalValue::InternalLinkage,
+				llvm::ConstantArray::get(tableTy, digDescs), "__prefetcher_dig_table");
+
+		llvm::Constant *idx[] = {
+				llvm::ConstantInt::get(llvm::Type::getInt64Ty(Mod->getContext()), 0),
+				llvm::ConstantInt::get(llvm::Type::getInt64Ty(Mod->getContext()), 0)};
+		auto *first = llvm::ConstantExpr::getGetElementPtr(tableTy, table, idx);
+
+		digTablePlaceholder->replaceAllUsesWith(first);
+		digTablePlaceholder->eraseFromParent();
+		digTablePlaceholder = nullptr;
+
+		auto *ctor = llvm::Function::Create(
+				llvm::FunctionType::get(llvm::Type::getVoidTy(Mod->getContext()), false),
+				llvm::GlobalValue::InternalLinkage, "__prefetcher_register_dig_table", Mod);
+		llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Mod->getContext(), "entry", ctor));
+
+		Builder.CreateCall(Mod->getFunction(PrefetcherRuntime::RegisterDigBatch),
+				{first, Builder.getInt64(digDescs.size())});
+		Builder.CreateRetVoid();
+
+		llvm::appendToGlobalCtors(*Mod, ctor, 0);
+	}
 
 	void declareRuntime() {
 		for (auto e : PrefetcherRuntime::Functions) {
@@ -208,15 +834,36 @@ public:
 				Mod->getFunction(PrefetcherRuntime::RegisterNodeWithSize)) {
 			llvm::SmallVector<llvm::Value *, 4> args;
 
+			// after the allocation, or at the start of the normal destination
+			// of an invoke
+			llvm::Instruction *insertPt = AI.allocInst->getNextNode();
+			if (auto *II = llvm::dyn_cast<llvm::InvokeInst>(AI.allocInst)) {
+				insertPt = &*II->getNormalDest()->getFirstInsertionPt();
+			}
+
 			args.push_back(AI.allocInst);
 			args.append(AI.inputArguments.begin(), AI.inputArguments.end());
 
-			args.push_back(llvm::ConstantInt::get(
-					llvm::IntegerType::get(Mod->getContext(), 32), NodeCount++));
+			if (AI.sizeIsCount) {
+				llvm::IRBuilder<> Builder(insertPt);
+				auto *i64Ty = Builder.getInt64Ty();
+				args[1] = Builder.CreateMul(Builder.CreateZExtOrTrunc(args[1], i64Ty),
+						Builder.CreateZExtOrTrunc(args[2], i64Ty));
+			}
+
+			llvm::StringRef allocFunc;
+			if (auto *CB = llvm::dyn_cast<llvm::CallBase>(AI.allocInst)) {
+				if (auto *callee = CB->getCalledFunction()) {
+					allocFunc = callee->getName();
+				}
+			}
+			uint64_t key = getNodeKey("node", AI.allocInst, allocFunc);
+			recordId("node", getNodeId(key), key, AI.allocInst);
 
-			auto *insertPt = AI.allocInst->getNextNode();
-			auto *call = llvm::CallInst::Create(llvm::cast<llvm::Function>(func),
-					args, "", insertPt);
+			args.push_back(llvm::ConstantInt::get(
+					llvm::Type::getInt64Ty(Mod->getContext()), getNodeId(key)));
+			auto *call = emitRegistration(llvm::cast<llvm::Function>(func),
+					DIGDescNode, args, insertPt);
 
 			emittedNodes.insert(AI.allocInst);
 			insertPts[AI.allocInst] = call;
@@ -285,84 +932,153 @@ public:
 				args.push_back(llvm::ConstantInt::get(
 						llvm::IntegerType::get(Mod->getContext(), 32), edge_type));
 
+				uint64_t key = getEdgeKey(gdi);
+				recordId("ranged", getTravEdgeId(key), key, gdi.source_gep);
 				args.push_back(llvm::ConstantInt::get(
-						llvm::IntegerType::get(Mod->getContext(), 32), edgeCount++));
+						llvm::IntegerType::get(Mod->getContext(), 32), getTravEdgeId(key)));
 
 				/* Insert the edge between the copied load instruction and the actual load instruction */
-				auto *call = llvm::CallInst::Create(llvm::cast<llvm::Function>(func),
-						args, "", dyn_cast<llvm::Instruction>(dyn_cast<llvm::Instruction>(gdi.target))->getNextNode());
+				auto *call = emitRegistration(llvm::cast<llvm::Function>(func), DIGDescTravEdge,
+						args, dyn_cast<llvm::Instruction>(dyn_cast<llvm::Instruction>(gdi.target))->getNextNode());
 
 				emittedTravEdges.insert(gdi);
 			}
 		}
 	}
 
-	llvm::Instruction * getFirstInstruction(const llvm::Function & F, llvm::Instruction * a, llvm::Instruction * b) {
-		for (auto &BB : F) {
-			for (auto &I : BB) {
-				if (&I == a) {
-					return a;
-				}
-
-				if (&I == b) {
-					return b;
-				}
+	// Orders two instructions by their position in the function layout. Block
+	// positions are computed once per function; within a block the instruction
+	// order kept by LLVM is used, so no walk of the function is needed.
+	bool comesBefore(const llvm::Function & F, const llvm::Instruction * a, const llvm::Instruction * b) {
+		if (&F != orderedFunc) {
+			blockOrder.clear();
+			unsigned pos = 0;
+			for (auto &BB : F) {
+				blockOrder[&BB] = pos++;
 			}
+			orderedFunc = &F;
 		}
-		assert(false && "Instruction not in current function!\n");
-		return nullptr;
+
+		assert(blockOrder.count(a->getParent()) && blockOrder.count(b->getParent()) &&
+				"Instruction not in current function!\n");
+
+		if (a->getParent() == b->getParent()) {
+			return a == b || a->comesBefore(b);
+		}
+
+		return blockOrder.lookup(a->getParent()) < blockOrder.lookup(b->getParent());
+	}
+
+	llvm::Instruction * getFirstInstruction(const llvm::Function & F, llvm::Instruction * a, llvm::Instruction * b) {
+		return comesBefore(F, a, b) ? a : b;
 	}
 
 	llvm::Instruction * getSecondInstruction(const llvm::Function & F, llvm::Instruction * a, llvm::Instruction * b) {
+		return comesBefore(F, a, b) ? b : a;
+	}
 
-		if (getFirstInstruction(F,a,b) == a) {
-			return b;
-		}
-		else if (getFirstInstruction(F,a,b) == b){
-			return a;
+	bool needLoadCopy(llvm::Function * f, llvm::Instruction * source_load, llvm::Instruction * target_load) {
+		if (target_load->getOpcode() == llvm::Instruction::Load &&
+				source_load->getFunction() == f && target_load->getFunction() == f) {
+			return comesBefore(*f, source_load, target_load);
 		}
-		assert(false && "Instruction not in current function!\n");
-		return nullptr;
+
+		return false;
 	}
 
-	bool needLoadCopy(llvm::Function * f, llvm::Instruction * source_load, llvm::Instruction * target_load) {
+	// Finds the first PHI node, in function order, that takes instr as an
+	// incoming value and can reach it. Only the users of instr are visited.
+	bool isUsedInPhi(llvm::Function * F, llvm::Instruction * instr, llvm::PHINode *& phi, DominatorTree & DT) {
+		llvm::PHINode * first = nullptr;
 
-		if (target_load->getOpcode() == llvm::Instruction::Load) {
-			for (auto & BB : *f) {
-				for (auto &I : BB) {
-					if (&I == source_load) {
-						return true;
-					}
+		for (auto * user : instr->users()) {
+			auto * user_phi = dyn_cast<llvm::PHINode>(user);
+			if (!user_phi || user_phi->getFunction() != F) {
+				continue;
+			}
 
-					if (&I == target_load) {
-						return false;
-					}
-				}
+			if (first && !comesBefore(*F, user_phi, first)) {
+				continue;
+			}
+
+			if (isPotentiallyReachable(user_phi->getParent(), instr->getParent(), nullptr, &DT)) {
+				first = user_phi;
 			}
 		}
 
+		if (first) {
+			phi = first;
+			return true;
+		}
 		return false;
 	}
 
-	bool isUsedInPhi(llvm::Function * F, llvm::Instruction * instr, llvm::PHINode *& phi, DominatorTree & DT) {
-		for (auto &BB : *F) {
-			for (auto &I : BB) {
-				if (llvm::PHINode * bb_phi = dyn_cast<llvm::PHINode>(&I)) {
-					if (isPotentiallyReachable(&BB, instr->getParent(), &DT)) {
-						for (int i = 0; i < bb_phi->getNumIncomingValues(); ++i) {
-							if (bb_phi->getIncomingValue(i) == dyn_cast<llvm::Value>(instr)) {
-								phi = bb_phi;
-								return true;
-							}
-						}
-					}
-				}
-				else {
+	// Moves a registration out of every enclosing loop in which all of its
+	// arguments are invariant, to the end of the loop preheader, so that it
+	// runs once instead of once per iteration.
+	llvm::Instruction * hoistOutOfLoops(llvm::Instruction * insertPt, llvm::ArrayRef<llvm::Value *> args, DominatorTree & DT) {
+		if (!LI) {
+			return insertPt;
+		}
+
+		for (llvm::Loop * L = LI->getLoopFor(insertPt->getParent()); L; L = L->getParentLoop()) {
+			llvm::BasicBlock * preheader = L->getLoopPreheader();
+			if (!preheader) {
+				break;
+			}
+
+			llvm::Instruction * hoistPt = preheader->getTerminator();
+			bool invariant = true;
+			for (llvm::Value * arg : args) {
+				auto * instr = dyn_cast<llvm::Instruction>(arg);
+				if (!L->isLoopInvariant(arg) || (instr && !DT.dominates(instr, hoistPt))) {
+					invariant = false;
 					break;
 				}
 			}
+
+			if (!invariant) {
+				break;
+			}
+
+			insertPt = hoistPt;
 		}
-		return false;
+
+		return insertPt;
+	}
+
+	// Array-of-structs edges follow one field of each element of the target.
+	// The runtime registers that field as a node of its own, starting at the
+	// field of the first element with one element of stride bytes per struct,
+	// so that the edge indexes it like a flat array. Returns the base address
+	// of the field node, which is the target of the edge.
+	llvm::Value *emitFieldView(GEPDepInfo &gdi, llvm::Value *target, llvm::Instruction *insertPt) {
+		llvm::IRBuilder<> Builder(insertPt);
+		llvm::Value *base = Builder.CreatePointerCast(target, Builder.getInt8PtrTy());
+		llvm::Value *view = Builder.CreateConstGEP1_64(Builder.getInt8Ty(), base, gdi.field_offset);
+
+		auto key = std::make_pair(target, gdi.field_offset);
+		if (fieldViews.count(key)) {
+			return view;
+		}
+
+		if (auto *func = Mod->getFunction(PrefetcherRuntime::RegisterFieldView)) {
+			auto *i64Ty = Builder.getInt64Ty();
+			uint64_t viewKey = getNodeKey("view", gdi.target_gep, std::to_string(gdi.field_offset));
+			llvm::Value *args[] = {
+					target,
+					llvm::ConstantInt::get(i64Ty, gdi.field_offset),
+					llvm::ConstantInt::get(i64Ty, gdi.stride),
+					llvm::ConstantInt::get(i64Ty, getNodeId(viewKey))};
+
+			emitRegistration(llvm::cast<llvm::Function>(func), DIGDescFieldView, args, insertPt);
+
+			recordId("view", getNodeId(viewKey), viewKey, gdi.target_gep);
+			fieldViews[key] = getNodeId(viewKey);
+			fieldViewCount++;
+		}
+
+		return view;
 	}
 
 	void emitRegisterTravEdge_New(GEPDepInfo &gdi, std::vector<GEPDepInfo> & emitted_traversal_edges, DominatorTree & DT) {
@@ -430,8 +1146,10 @@ public:
 				args.push_back(llvm::ConstantInt::get(
 						llvm::IntegerType::get(Mod->getContext(), 32), BaseOffset_int32_t));
 
+				uint64_t key = getEdgeKey(gdi);
+				recordId("trav", getTravEdgeId(key), key, gdi.target_gep);
 				args.push_back(llvm::ConstantInt::get(
-						llvm::IntegerType::get(Mod->getContext(), 32), edgeCount++));
+						llvm::IntegerType::get(Mod->getContext(), 32), getTravEdgeId(key)));
 
 				if (!insertPt) { // If insertion point hasn't been decided by Phi Node
 					if (llvm::dyn_cast<llvm::GlobalValue>(gdi.source) && llvm::dyn_cast<llvm::GlobalValue>(gdi.target)) {
@@ -471,14 +1189,547 @@ public:
 					}
 				}
 
-				auto *call = llvm::CallInst::Create(llvm::cast<llvm::Function>(func),
-						args, "", insertPt);
+				insertPt = hoistOutOfLoops(insertPt, args, DT);
+
+				if (gdi.field) {
+					args[1] = emitFieldView(gdi, args[1], insertPt);
+				}
+
+				auto *call = emitRegistration(llvm::cast<llvm::Function>(func),
+						DIGDescTravEdge, args, insertPt);
 
 				emittedTravEdges.insert(gdi);
 			}
 		}
 	}
 
+	// Walks back from an index operand of the target GEP to the load it was
+	// derived from. Only casts and binary operations with a constant operand
+	// are allowed in between, so that the chain can be safely replayed.
+	bool getIndexChain(llvm::Value * index, llvm::Instruction * load, llvm::SmallVectorImpl<llvm::Instruction*> & chain) {
+		llvm::Value * v = index;
+
+		while (v != load) {
+			if (chain.size() > 8) {
+				return false;
+			}
+
+			if (auto * cast = dyn_cast<llvm::CastInst>(v)) {
+				chain.push_back(cast);
+				v = cast->getOperand(0);
+			}
+			else if (auto * binop = dyn_cast<llvm::BinaryOperator>(v)) {
+				if (isa<llvm::Constant>(binop->getOperand(1))) {
+					v = binop->getOperand(0);
+				}
+				else if (isa<llvm::Constant>(binop->getOperand(0))) {
+					v = binop->getOperand(1);
+				}
+				else {
+					return false;
+				}
+				chain.push_back(binop);
+			}
+			else {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Lowers an A[B[i]] edge to a prefetch of &A[B[i + D]]. The lookahead index
+	// is clamped to the loop bound with the loop's own exit comparison, so the
+	// speculative load of B never goes past the last element accessed by the
+	// loop, nor wraps around the index type.
+	bool emitSoftwarePrefetch(GEPDepInfo &gdi, unsigned distance, DominatorTree & DT) {
+		auto * src_gep = dyn_cast_or_null<llvm::GetElementPtrInst>(gdi.source_gep);
+		auto * tgt_gep = dyn_cast_or_null<llvm::GetElementPtrInst>(gdi.target_gep);
+		auto * ld = dyn_cast_or_null<llvm::LoadInst>(gdi.source_use);
+
+		if (!src_gep || !tgt_gep || !ld || !LI || !SE || distance == 0) {
+			return false;
+		}
+
+		if (ld->getPointerOperand()->stripPointerCasts() != src_gep || !DT.dominates(src_gep, tgt_gep)) {
+			return false;
+		}
+
+		/* The last index of the source GEP has to be (a cast of) the loop induction variable */
+		unsigned iv_idx = src_gep->getNumOperands() - 1;
+		auto * iv_cast = dyn_cast<llvm::CastInst>(src_gep->getOperand(iv_idx));
+		auto * iv = dyn_cast<llvm::PHINode>(iv_cast ? iv_cast->getOperand(0) : src_gep->getOperand(iv_idx));
+
+		if (!iv) {
+			return false;
+		}
+
+		llvm::Loop * L = LI->getLoopFor(iv->getParent());
+		if (!L || !L->contains(tgt_gep) || L->getInductionVariable(*SE) != iv) {
+			return false;
+		}
+
+		auto bounds = L->getBounds(*SE);
+		if (!bounds || bounds->getDirection() != llvm::Loop::LoopBounds::Direction::Increasing) {
+			return false;
+		}
+
+		auto * step = dyn_cast<llvm::ConstantInt>(bounds->getStepValue());
+		llvm::Value & final_iv = bounds->getFinalIVValue();
+		if (!step || !L->isLoopInvariant(&final_iv) || final_iv.getType() != iv->getType()) {
+			return false;
+		}
+
+		/* Only `iv < final` and `iv <= final` exit tests give a bound ahead can be checked against */
+		llvm::ICmpInst::Predicate pred = bounds->getCanonicalPredicate();
+		if (pred != llvm::ICmpInst::ICMP_SLT && pred != llvm::ICmpInst::ICMP_SLE &&
+				pred != llvm::ICmpInst::ICMP_ULT && pred != llvm::ICmpInst::ICMP_ULE) {
+			return false;
+		}
+
+		unsigned tgt_idx = 0;
+		llvm::SmallVector<llvm::Instruction*,4> chain;
+		for (unsigned i = 1; i < tgt_gep->getNumOperands(); ++i) {
+			chain.clear();
+			if (getIndexChain(tgt_gep->getOperand(i), ld, chain)) {
+				tgt_idx = i;
+				break;
+			}
+		}
+
+		if (!tgt_idx) {
+			return false;
+		}
+
+		llvm::IRBuilder<> Builder(tgt_gep);
+
+		llvm::Value * ahead = Builder.CreateAdd(iv, llvm::ConstantInt::get(iv->getType(), distance * step->getSExtValue()));
+		llvm::Value * no_wrap = Builder.CreateICmp(llvm::ICmpInst::isSigned(pred) ? llvm::ICmpInst::ICMP_SGT : llvm::ICmpInst::ICMP_UGT, ahead, iv);
+		llvm::Value * in_bounds = Builder.CreateAnd(no_wrap, Builder.CreateICmp(pred, ahead, &final_iv));
+		llvm::Value * ahead_iv = Builder.CreateSelect(in_bounds, ahead, iv);
+
+		if (iv_cast) {
+			ahead_iv = Builder.CreateCast(iv_cast->getOpcode(), ahead_iv, iv_cast->getDestTy());
+		}
+
+		llvm::Instruction * ahead_src = src_gep->clone();
+		ahead_src->setOperand(iv_idx, ahead_iv);
+		Builder.Insert(ahead_src);
+
+		llvm::Instruction * ahead_ld = ld->clone();
+		ahead_ld->setOperand(ld->getPointerOperandIndex(), Builder.CreatePointerCast(ahead_src, ld->getPointerOperandType()));
+		Builder.Insert(ahead_ld);
+
+		/* Replay the index computation between the load and the target GEP */
+		llvm::Value * ahead_val = ahead_ld;
+		for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+			llvm::Instruction * c = (*it)->clone();
+			for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+				if (!isa<llvm::Constant>(c->getOperand(i))) {
+					c->setOperand(i, ahead_val);
+				}
+			}
+			Builder.Insert(c);
+			ahead_val = c;
+		}
+
+		llvm::Instruction * ahead_tgt = tgt_gep->clone();
+		ahead_tgt->setOperand(tgt_idx, ahead_val);
+		Builder.Insert(ahead_tgt);
+
+		llvm::Function * prefetch = llvm::Intrinsic::getDeclaration(Mod, llvm::Intrinsic::prefetch, {Builder.getInt8PtrTy()});
+
+		/* read access, high temporal locality, data cache */
+		Builder.CreateCall(prefetch, {Builder.CreatePointerCast(ahead_tgt, Builder.getInt8PtrTy()),
+				Builder.getInt32(0), Builder.getInt32(3), Builder.getInt32(1)});
+
+#if DEBUG == 1
+		errs() << "Emit software prefetch: " << *ahead_tgt << "\n";
+#endif
+
+		return true;
+	}
+
+	void setFunctionAnalyses(llvm::LoopInfo * loopInfo, llvm::ScalarEvolution * scalarEvolution,
+			llvm::BlockFrequencyInfo * blockFreq = nullptr) {
+		LI = loopInfo;
+		SE = scalarEvolution;
+		BFI = blockFreq;
+		orderedFunc = nullptr;
+	}
+
+	// An edge is hot if its source access is deep enough in loops and runs
+	// often enough per call of its function. The block frequencies come from
+	// the branch probabilities, which follow the profile when the function
+	// has one, and then the absolute count of the access is checked as well.
+	bool isHotEdge(GEPDepInfo &gdi) {
+		auto * src = dyn_cast_or_null<llvm::Instruction>(gdi.source_use ? gdi.source_use : gdi.source_gep);
+
+		if (!src || !LI || !BFI) {
+			return false;
+		}
+
+		llvm::BasicBlock * BB = src->getParent();
+		if (LI->getLoopDepth(BB) < std::max(HotLoopMinDepth.getValue(), 1u)) {
+			return false;
+		}
+
+		if (BFI->getBlockFreq(BB).getFrequency() < BFI->getEntryFreq() * HotLoopMinFreq) {
+			return false;
+		}
+
+		auto count = BFI->getBlockProfileCount(BB);
+		return !count || *count >= HotLoopMinCount;
+	}
+
+	// Adds the allocations among allocInsts that V may be derived from to
+	// nodes. Returns false if there is none.
+	bool findNodes(llvm::Value *V, const llvm::SmallPtrSetImpl<llvm::Value *> &allocInsts,
+			llvm::SmallPtrSetImpl<llvm::Value *> &nodes) {
+		llvm::SmallPtrSet<llvm::Value *, 8> origins;
+		if (allocOrigins) {
+			allocOrigins->find(V, origins);
+		}
+		else {
+			origins.insert(V);
+		}
+
+		bool found = false;
+		for (llvm::Value *origin : origins) {
+			if (allocInsts.count(origin)) {
+				nodes.insert(origin);
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	// Drops the edges that are not hot, with -prefetcher-hot-loops.
+	void removeColdEdges(llvm::SmallVectorImpl<GEPDepInfo> &geps) {
+		if (!HotLoops) {
+			return;
+		}
+
+		auto cold = std::remove_if(geps.begin(), geps.end(), [&](GEPDepInfo &gdi) {
+			if (isHotEdge(gdi)) {
+				return false;
+			}
+#if DEBUG == 1
+			errs() << "Skip cold edge: " << *gdi.target << "\n";
+#endif
+			return true;
+		});
+		geps.erase(cold, geps.end());
+	}
+
+	// Length of the longest indirection chain starting at the given node. The
+	// chain length found by the analysis covers chains of any depth within a
+	// function; following the targets adds the hops that cross functions.
+	// Depths are memoised per node in depths, which the caller keeps for one
+	// set of edges. A node reached again through a cycle ends the chain.
+	unsigned getChainDepth(const std::vector<GEPDepInfo> & all_geps, llvm::Value * node,
+			llvm::DenseMap<llvm::Value *, unsigned> & depths) {
+		auto found = depths.find(node);
+		if (found != depths.end()) {
+			return found->second;
+		}
+		depths[node] = 0;
+
+		unsigned max_depth = 0;
+		for (auto &gdi : all_geps) {
+			if (gdi.source == node && gdi.target != node) {
+				max_depth = std::max(max_depth, gdi.chain_length);
+				max_depth = std::max(max_depth, 1 + getChainDepth(all_geps, gdi.target, depths));
+			}
+		}
+
+		return depths[node] = max_depth;
+	}
+
+	// Estimates how many iterations ahead of the loop containing the edge source
+	// the prefetcher has to run so that a chain of the given depth arrives in
+	// time. Every hop of the chain costs a full memory latency, which is divided
+	// by the size of the loop body as a proxy for the time per iteration.
+	// The estimate is capped by the trip count when SCEV can compute one.
+	// Returns 0 when the source is not inside a loop.
+	unsigned computeLookahead(GEPDepInfo &gdi, unsigned depth) {
+		auto * src = dyn_cast_or_null<llvm::Instruction>(gdi.source_use ? gdi.source_use : gdi.source_gep);
+
+		if (!src || !LI || !SE) {
+			return 0;
+		}
+
+		llvm::Loop * L = LI->getLoopFor(src->getParent());
+		if (!L) {
+			return 0;
+		}
+
+		unsigned body_size = 0;
+		for (auto * BB : L->blocks()) {
+			body_size += BB->size();
+		}
+
+		unsigned iterations = (PrefetchLatency * std::max(depth, 1u) + body_size - 1) / std::max(body_size, 1u);
+
+		unsigned trip_count = SE->getSmallConstantTripCount(L);
+		if (!trip_count) {
+			trip_count = SE->getSmallConstantMaxTripCount(L);
+		}
+
+		if (trip_count) {
+			iterations = std::min(iterations, trip_count);
+		}
+
+		return std::max(iterations, 1u);
+	}
+
+	// Number of elements of the source node that are covered per loop iteration.
+	unsigned getInductionStride(GEPDepInfo &gdi) {
+		auto * src_gep = dyn_cast_or_null<llvm::GetElementPtrInst>(gdi.source_gep);
+
+		if (!src_gep || !SE) {
+			return 1;
+		}
+
+		auto * idx = SE->getSCEV(src_gep->getOperand(src_gep->getNumOperands() - 1));
+		if (auto * ar = dyn_cast<llvm::SCEVAddRecExpr>(idx)) {
+			if (auto * step = dyn_cast<llvm::SCEVConstant>(ar->getStepRecurrence(*SE))) {
+				return std::max<uint64_t>(step->getAPInt().abs().getLimitedValue(1024), 1);
+			}
+		}
+
+		return 1;
+	}
+
+	// Maps a lookahead in elements to the closest registered trigger function.
+	// Lookaheads shorter than the smallest static offset are left to UpToOffset,
+	// which does not run past the end of short ranges.
+	FuncId getTriggerFunc(unsigned elements) {
+		if (elements < 32) {
+			return UpToOffset;
+		}
+		else if (elements < 48) {
+			return StaticOffset_32;
+		}
+		else if (elements < 160) {
+			return StaticOffset_64;
+		}
+		else if (elements < 384) {
+			return StaticOffset_256;
+		}
+		else if (elements < 768) {
+			return StaticOffset_512;
+		}
+
+		return StaticOffset_1024;
+	}
+
+	// Calls the runtime before each load from a trigger node, so that a
+	// runtime without hardware support can prefetch ahead of it.
+	void emitTriggerHooks(llvm::SmallVectorImpl<GEPDepInfo> &geps,
+			llvm::SmallVectorImpl<GEPDepInfo> &ri_geps) {
+		llvm::SmallPtrSet<llvm::Value *, 16> targets;
+		for (auto &gdi : geps) {
+			targets.insert(gdi.target);
+		}
+		for (auto &gdi : ri_geps) {
+			targets.insert(gdi.target);
+		}
+
+		llvm::SmallPtrSet<llvm::Instruction *, 16> hooked;
+		auto emitHook = [&](GEPDepInfo &gdi) {
+			auto *ld = dyn_cast_or_null<llvm::LoadInst>(gdi.source_use);
+			if (!ld || targets.count(gdi.source) || !hooked.insert(ld).second) {
+				return;
+			}
+
+			llvm::Value *args[] = {ld->getPointerOperand()};
+			llvm::CallInst::Create(Mod->getFunction(PrefetcherRuntime::TriggerAccess),
+					args, "", ld);
+		};
+
+		for (auto &gdi : geps) {
+			emitHook(gdi);
+		}
+		for (auto &gdi : ri_geps) {
+			emitHook(gdi);
+		}
+	}
+
+	// Outlined body of an OpenMP parallel region: named by clang after the
+	// enclosing function, and passed to __kmpc_fork_call.
+	bool isParallelRegion(llvm::Function &F) {
+		if (F.getName().contains(".omp_outlined.")) {
+			return true;
+		}
+
+		for (llvm::User *U : F.users()) {
+			llvm::SmallVector<llvm::User *, 4> uses = {U};
+			if (isa<llvm::ConstantExpr>(U)) {
+				uses.assign(U->user_begin(), U->user_end());
+			}
+
+			for (llvm::User *use : uses) {
+				auto *call = dyn_cast<llvm::CallBase>(use);
+				auto *callee = call ? call->getCalledFunction() : nullptr;
+				if (callee && callee->getName() == "__kmpc_fork_call") {
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	// Call that computes the iterations of a statically scheduled worksharing
+	// loop run by the calling thread, which it stores to *plower and *pupper.
+	bool isStaticInit(llvm::CallBase *call) {
+		auto *callee = call->getCalledFunction();
+		if (!callee || !callee->getName().startswith("__kmpc_for_static_init_") ||
+				call->arg_size() < 9) {
+			return false;
+		}
+
+		// kmp_sch_static, without a chunk size
+		auto *sched = dyn_cast<llvm::ConstantInt>(call->getArgOperand(2));
+		return sched && sched->getZExtValue() == 34;
+	}
+
+	// Last iteration of the whole worksharing loop, which clang stores to
+	// *pupper before the call. The runtime overwrites it with the last
+	// iteration of the calling thread, which clang clamps to this value only
+	// after the call.
+	llvm::Value *getStaticInitLastIteration(llvm::CallBase *init) {
+		llvm::Value *pupper = init->getArgOperand(5)->stripPointerCasts();
+		llvm::Instruction *I = init->getPrevNode();
+		llvm::BasicBlock *BB = init->getParent();
+
+		while (true) {
+			if (!I) {
+				BB = BB->getSinglePredecessor();
+				if (!BB || BB == init->getParent()) {
+					return nullptr;
+				}
+				I = BB->getTerminator();
+				continue;
+			}
+
+			if (auto *store = dyn_cast<llvm::StoreInst>(I)) {
+				if (store->getPointerOperand()->stripPointerCasts() == pupper) {
+					return store->getValueOperand();
+				}
+			}
+			else if (isa<llvm::CallBase>(I) && I->mayWriteToMemory()) {
+				return nullptr;
+			}
+
+			I = I->getPrevNode();
+		}
+	}
+
+	// In a parallel region, registers a trigger edge for each trigger node
+	// indexed by a statically scheduled loop, bounded to the iterations of
+	// the calling thread, so that the runtime can keep the prefetches of each
+	// core within its own part of the node. These are always direct calls,
+	// since the bounds differ between threads. The upper bound is clamped to
+	// the last iteration of the loop, as the loop itself does.
+	void emitRegisterTrigEdgeRanges(llvm::Function &F, llvm::SmallVectorImpl<GEPDepInfo> &geps,
+			llvm::SmallVectorImpl<GEPDepInfo> &ri_geps, DominatorTree &DT) {
+		llvm::SmallVector<llvm::CallBase *, 4> inits;
+		for (auto &BB : F) {
+			for (auto &I : BB) {
+				auto *call = dyn_cast<llvm::CallBase>(&I);
+				if (call && isStaticInit(call)) {
+					inits.push_back(call);
+				}
+			}
+		}
+
+		auto *func = Mod->getFunction(PrefetcherRuntime::RegisterTrigEdgeRange);
+		if (inits.empty() || !func || !SE) {
+			return;
+		}
+
+		std::vector<GEPDepInfo> all_geps(geps.begin(), geps.end());
+		all_geps.insert(all_geps.end(), ri_geps.begin(), ri_geps.end());
+		llvm::DenseMap<llvm::Value *, unsigned> depths;
+
+		llvm::SmallPtrSet<llvm::Value *, 16> targets;
+		for (auto &gdi : all_geps) {
+			targets.insert(gdi.target);
+		}
+
+		std::set<std::pair<llvm::CallBase *, llvm::Value *>> emitted;
+		for (auto &gdi : all_geps) {
+			auto *src_gep = dyn_cast_or_null<llvm::GetElementPtrInst>(gdi.source_gep);
+			if (targets.count(gdi.source) || !src_gep) {
+				continue;
+			}
+
+			// the trigger node has to be walked one element per iteration
+			auto *idx = dyn_cast<llvm::SCEVAddRecExpr>(
+					SE->getSCEV(src_gep->getOperand(src_gep->getNumOperands() - 1)));
+			if (!idx || !idx->getStepRecurrence(*SE)->isOne()) {
+				continue;
+			}
+
+			for (auto *init : inits) {
+				if (!DT.dominates(init, src_gep) || !emitted.insert({init, gdi.source}).second) {
+					continue;
+				}
+
+				// the range of the last thread would run past the loop otherwise
+				llvm::Value *last = getStaticInitLastIteration(init);
+				if (!last) {
+					continue;
+				}
+
+				// after the bounds are known and the node base is defined
+				llvm::Instruction *insertPt = init->getNextNode();
+				if (auto *src = dyn_cast<llvm::Instruction>(gdi.source)) {
+					if (isa<llvm::InvokeInst>(src)) {
+						continue;
+					}
+					if (DT.dominates(init, src)) {
+						insertPt = isa<llvm::PHINode>(src) ?
+							src->getParent()->getFirstNonPHI() : src->getNextNode();
+					}
+					else if (!DT.dominates(src, init)) {
+						continue;
+					}
+				}
+
+				llvm::IRBuilder<> Builder(insertPt);
+				auto *i64Ty = Builder.getInt64Ty();
+				auto *ivTy = Builder.getIntNTy(
+						init->getCalledFunction()->getName().contains("_8") ? 64 : 32);
+				bool isSigned = !init->getCalledFunction()->getName().endswith("u");
+
+				llvm::Value *lower = Builder.CreateLoad(ivTy, init->getArgOperand(4));
+				llvm::Value *upper = Builder.CreateLoad(ivTy, init->getArgOperand(5));
+				llvm::Value *over = isSigned ?
+					Builder.CreateICmpSGT(upper, last) : Builder.CreateICmpUGT(upper, last);
+				upper = Builder.CreateSelect(over, last, upper);
+				lower = Builder.CreateIntCast(lower, i64Ty, isSigned);
+				upper = Builder.CreateAdd(Builder.CreateIntCast(upper, i64Ty, isSigned),
+						Builder.getInt64(1));
+
+				unsigned lookahead = computeLookahead(gdi, getChainDepth(all_geps, gdi.source, depths));
+
+				llvm::Value *args[] = {
+						gdi.source, lower, upper,
+						Builder.getInt32(getTriggerFunc(lookahead)),
+						Builder.getInt32(NeverSquash)};
+				Builder.CreateCall(func, args);
+
+				rangeTriggerCount++;
+				for (auto &e : all_geps) {
+					rangeTravEdgeCount += e.source == gdi.source;
+				}
+			}
+		}
+	}
+
 	// If a node is a source but not a target, then it is a trigger node.
 	void emitRegisterTrigEdge(llvm::SmallVectorImpl<GEPDepInfo> &geps, llvm::SmallVectorImpl<GEPDepInfo> &ri_geps) {
 
@@ -490,38 +1741,54 @@ public:
 		for (auto &gdi : ri_geps) {
 			all_geps.push_back(gdi);
 		}
+		llvm::DenseMap<llvm::Value *, unsigned> depths;
 
+		llvm::SmallPtrSet<llvm::Value *, 16> targets;
 		for (auto &gdi : all_geps) {
-			bool trigger_node = true;
-			for (auto &gdi2 : all_geps) {
-				if (gdi.source == gdi2.target) {
-					trigger_node = false;
-				}
-			}
+			targets.insert(gdi.target);
+		}
+
+		for (auto &gdi : all_geps) {
+			bool trigger_node = !targets.count(gdi.source);
 
 			if (trigger_node) {
+				// the source is the allocation itself, or a pointer to it passed
+				// through calls, returns, globals or struct fields
+				llvm::SmallPtrSet<llvm::Value *, 8> nodes;
+				if (emittedNodes.count(gdi.source)) {
+					nodes.insert(gdi.source);
+				}
+				else if (allocOrigins) {
+					allocOrigins->find(gdi.source, nodes);
+				}
+
+				for (llvm::Value *node : nodes) {
 
-				if(emittedTrigEdges.count(gdi.source) == 0 && emittedNodes.count(gdi.source)) {
+					if(emittedTrigEdges.count(node) == 0 && emittedNodes.count(node)) {
 
-					if (auto *func =
-							Mod->getFunction(PrefetcherRuntime::RegisterTrigEdge1)) {
-						llvm::SmallVector<llvm::Value *, 4> args;
-						args.push_back(gdi.source);
-						args.push_back(gdi.source);
+						if (auto *func =
+								Mod->getFunction(PrefetcherRuntime::RegisterTrigEdge1)) {
+							llvm::SmallVector<llvm::Value *, 4> args;
+							args.push_back(node);
+							args.push_back(node);
 
-						args.push_back(llvm::ConstantInt::get(
-								llvm::IntegerType::get(Mod->getContext(), 32), UpToOffset));
+							unsigned lookahead = computeLookahead(gdi, getChainDepth(all_geps, gdi.source, depths));
 
-						args.push_back(llvm::ConstantInt::get(
-								llvm::IntegerType::get(Mod->getContext(), 32), NeverSquash));
+							args.push_back(llvm::ConstantInt::get(
+									llvm::IntegerType::get(Mod->getContext(), 32),
+									getTriggerFunc(lookahead * getInductionStride(gdi))));
 
-						auto *insertPt = insertPts[gdi.source];
-						auto *call =
-								llvm::CallInst::Create(llvm::cast<llvm::Function>(func), args, "",
-										insertPt->getNextNode());
+							args.push_back(llvm::ConstantInt::get(
+									llvm::IntegerType::get(Mod->getContext(), 32), NeverSquash));
 
-						TriggerEdgeCount++;
-						emittedTrigEdges.insert(gdi.source);
+							auto *insertPt = insertPts[node];
+							auto *call =
+									emitRegistration(llvm::cast<llvm::Function>(func), DIGDescTrigEdge,
+											args, insertPt->getNextNode());
+
+							TriggerEdgeCount++;
+							emittedTrigEdges.insert(node);
+						}
 					}
 				}
 			}
@@ -529,6 +1796,16 @@ public:
 	}
 };
 
+// Per-function analyses used by the codegen, provided by whichever pass
+// manager runs it.
+struct PrefetcherCodegenAnalyses {
+	std::function<PrefetcherAnalysisResult *(llvm::Function &)> getPFA;
+	std::function<llvm::DominatorTree &(llvm::Function &)> getDT;
+	std::function<llvm::LoopInfo &(llvm::Function &)> getLI;
+	std::function<llvm::ScalarEvolution &(llvm::Function &)> getSE;
+	std::function<llvm::BlockFrequencyInfo &(llvm::Function &)> getBFI;
+};
+
 class PrefetcherCodegenPass : public llvm::ModulePass {
 public:
 	static char ID;
@@ -546,9 +1823,11 @@ static llvm::RegisterPass<PrefetcherCodegenPass>
 Y("prefetcher-codegen", "Prefetcher Codegen Pass", false, true);
 
 static void
-registerPrefetcherCodegenPass(const llvm::PassManagerBuilder &Builder,
+registerPrefetcherCodegenPass(const llvm::PassManagerBuilder & /* Builder */,
 		llvm::legacy::PassManagerBase &PM) {
-	PM.add(new PrefetcherCodegenPass());
+	if (!PrefetcherLTO) {
+		PM.add(new PrefetcherCodegenPass());
+	}
 
 	return;
 }
@@ -557,6 +1836,22 @@ static llvm::RegisterStandardPasses
 RegisterPrefetcherCodegenPass(llvm::PassManagerBuilder::EP_EarlyAsPossible,
 		registerPrefetcherCodegenPass);
 
+// In LTO mode the codegen runs once on the linked module, where allocations
+// and traversals from different translation units are visible together.
+static void
+registerPrefetcherCodegenPassLTO(const llvm::PassManagerBuilder & /* Builder */,
+		llvm::legacy::PassManagerBase &PM) {
+	if (PrefetcherLTO) {
+		PM.add(new PrefetcherCodegenPass());
+	}
+
+	return;
+}
+
+static llvm::RegisterStandardPasses
+RegisterPrefetcherCodegenPassLTO(llvm::PassManagerBuilder::EP_FullLinkTimeOptimizationEarly,
+		registerPrefetcherCodegenPassLTO);
+
 static bool shouldSkip(llvm::Function &CurFunc) {
 	if (CurFunc.isIntrinsic() || CurFunc.empty()) {
 		llvm::errs() << "func is instrinsic or empty\n";
@@ -573,18 +1868,114 @@ static bool shouldSkip(llvm::Function &CurFunc) {
 	return false;
 }
 
-bool PrefetcherCodegenPass::runOnModule(llvm::Module &CurMod) {
+// Points the codegen at the analyses of F. ScalarEvolution is fetched last,
+// and no other analysis may be requested until the codegen is done with F:
+// the legacy pass manager reruns the function analyses on every getAnalysis
+// call from a module pass, which recomputes LoopInfo, DominatorTree and
+// BlockFrequencyInfo in place but frees the ScalarEvolution handed out
+// before.
+static void setFunctionAnalyses(PrefetcherCodegen &pfcg, PrefetcherCodegenAnalyses &A,
+		llvm::Function &F) {
+	llvm::LoopInfo &LI = A.getLI(F);
+	llvm::BlockFrequencyInfo *BFI = HotLoops ? &A.getBFI(F) : nullptr;
+	pfcg.setFunctionAnalyses(&LI, &A.getSE(F), BFI);
+}
+
+static bool runPrefetcherCodegen(llvm::Module &CurMod, PrefetcherCodegenAnalyses &A) {
 
 	bool hasModuleChanged = false;
 
 	PrefetcherCodegen pfcg(CurMod);
-	pfcg.declareRuntime();
 
 	unsigned totalNodesNum = 0;
 	unsigned totalEdgesNum = 0;
 
 	std::vector<GEPDepInfo> emitted_traversal_edges;
 
+	if (CodegenMode == PrefetcherCodegenMode::Profile) {
+		pfcg.declareRuntime();
+
+		for (llvm::Function &curFunc : CurMod) {
+			if (shouldSkip(curFunc)) {
+				continue;
+			}
+
+			PrefetcherAnalysisResult * pfa = A.getPFA(curFunc);
+
+			pfcg.numberSites(curFunc);
+			std::vector<uint64_t> keys;
+			for (GEPDepInfo &gdi : pfa->geps) {
+				keys.push_back(pfcg.getEdgeKey(gdi));
+			}
+
+			for (unsigned i = 0; i < pfa->geps.size(); ++i) {
+				pfcg.emitEdgeProfile(pfa->geps[i], keys[i]);
+			}
+		}
+
+		pfcg.emitEdgeProfileTable();
+
+		return true;
+	}
+
+	if (!EdgeProfileFile.empty()) {
+		pfcg.loadEdgeProfile();
+	}
+
+	if (CodegenMode == PrefetcherCodegenMode::SoftwarePrefetch) {
+		for (llvm::Function &curFunc : CurMod) {
+			if (shouldSkip(curFunc)) {
+				continue;
+			}
+
+			PrefetcherAnalysisResult * pfa = A.getPFA(curFunc);
+
+			DominatorTree &DT = A.getDT(curFunc);
+			setFunctionAnalyses(pfcg, A, curFunc);
+
+			llvm::SmallPtrSet<llvm::Instruction *, 8> prefetched;
+			llvm::SmallVector<GEPDepInfo, 8> geps;
+			pfcg.numberSites(curFunc);
+			pfcg.getProfitableEdges(pfa->geps, geps);
+			pfcg.removeColdEdges(geps);
+			std::vector<GEPDepInfo> all_geps(geps.begin(), geps.end());
+			llvm::DenseMap<llvm::Value *, unsigned> depths;
+
+			/* Ranged edges are covered by the single-valued edges that feed and consume the range */
+			for (GEPDepInfo & gdi : geps) {
+				unsigned distance = SWPrefetchDistance;
+				if (!SWPrefetchDistance.getNumOccurrences()) {
+					if (unsigned lookahead = pfcg.computeLookahead(gdi, pfcg.getChainDepth(all_geps, gdi.source, depths))) {
+						distance = lookahead;
+					}
+				}
+
+				if (gdi.target_gep && !prefetched.count(gdi.target_gep) &&
+						pfcg.emitSoftwarePrefetch(gdi, distance, DT)) {
+					prefetched.insert(gdi.target_gep);
+					hasModuleChanged = true;
+				}
+			}
+		}
+
+		return hasModuleChanged;
+	}
+
+	pfcg.declareRuntime();
+	hasModuleChanged = true;
+
+	AllocationOrigins origins(CurMod);
+	pfcg.setAllocationOrigins(&origins);
+
+	/* The edges of each function are selected first, so that with
+	 * -prefetcher-hot-loops only the allocations they reach become nodes */
+	struct FunctionEdges {
+		llvm::Function *F;
+		llvm::SmallVector<GEPDepInfo, 8> geps;
+		llvm::SmallVector<GEPDepInfo, 8> ri_geps;
+	};
+	std::vector<FunctionEdges> funcEdges;
+	std::vector<myAllocCallInfo> allocs;
 
 	for (llvm::Function &curFunc : CurMod) {
 		if (shouldSkip(curFunc)) {
@@ -593,30 +1984,78 @@ bool PrefetcherCodegenPass::runOnModule(llvm::Module &CurMod) {
 			continue;
 		}
 
-		llvm::errs() << "processing func: "
-				<< curFunc.getName() << '\n';
+		PrefetcherAnalysisResult * pfa = A.getPFA(curFunc);
 
-		PrefetcherAnalysisResult * pfa =
-				this->getAnalysis<PrefetcherPass>(curFunc).getPFA();
+		for (auto &ai : pfa->allocs) {
+			if (ai.allocInst) {
+				allocs.push_back(ai);
+			}
+		}
 
-		DominatorTree &DT = this->getAnalysis<DominatorTreeWrapperPass>(curFunc).getDomTree();
+		setFunctionAnalyses(pfcg, A, curFunc);
 
+		FunctionEdges fe;
+		fe.F = &curFunc;
+		pfcg.numberSites(curFunc);
+		pfcg.getProfitableEdges(pfa->geps, fe.geps);
+		fe.ri_geps.append(pfa->ri_geps.begin(), pfa->ri_geps.end());
+		pfcg.removeColdEdges(fe.geps);
+		pfcg.removeColdEdges(fe.ri_geps);
+		funcEdges.push_back(std::move(fe));
+	}
 
-		for (auto &ai : pfa->allocs) {
-			if (ai.allocInst) {
-				pfcg.emitRegisterNode(ai);
-				totalNodesNum++;
+	llvm::SmallPtrSet<llvm::Value *, 16> reached;
+	bool allNodes = !HotLoops;
+	if (HotLoops) {
+		llvm::SmallPtrSet<llvm::Value *, 16> allocInsts;
+		for (auto &ai : allocs) {
+			allocInsts.insert(ai.allocInst);
+		}
+
+		for (auto &fe : funcEdges) {
+			for (auto *edges : {&fe.geps, &fe.ri_geps}) {
+				for (auto &gdi : *edges) {
+					allNodes |= !pfcg.findNodes(gdi.source, allocInsts, reached);
+					allNodes |= !pfcg.findNodes(gdi.target, allocInsts, reached);
+				}
 			}
 		}
+	}
+
+	/* Nodes of all functions are emitted before edges, so that trigger edges
+	 * can be placed at allocations made in other functions */
+	for (auto &ai : allocs) {
+		if (allNodes || reached.count(ai.allocInst)) {
+			pfcg.emitRegisterNode(ai);
+			totalNodesNum++;
+		}
+	}
+
+	for (auto &fe : funcEdges) {
+		llvm::Function &curFunc = *fe.F;
+
+		llvm::errs() << "processing func: "
+				<< curFunc.getName() << '\n';
+
+		DominatorTree &DT = A.getDT(curFunc);
+		setFunctionAnalyses(pfcg, A, curFunc);
+
+		pfcg.emitRegisterTrigEdge(fe.geps, fe.ri_geps);
+
+		if (pfcg.isParallelRegion(curFunc)) {
+			pfcg.emitRegisterTrigEdgeRanges(curFunc, fe.geps, fe.ri_geps, DT);
+		}
 
-		pfcg.emitRegisterTrigEdge(pfa->geps, pfa->ri_geps);
+		if (TriggerHooks) {
+			pfcg.emitTriggerHooks(fe.geps, fe.ri_geps);
+		}
 
-		for (GEPDepInfo & gdi : pfa->ri_geps) {
+		for (GEPDepInfo & gdi : fe.ri_geps) {
 			pfcg.emitRegisterRITravEdge_New(gdi, PointerBounds_uint64_t, emitted_traversal_edges);
 			totalEdgesNum++;
 		}
 
-		for (GEPDepInfo & gdi : pfa->geps) {
+		for (GEPDepInfo & gdi : fe.geps) {
 			pfcg.emitRegisterTravEdge_New(gdi, emitted_traversal_edges, DT);
 			totalEdgesNum++;
 		}
@@ -626,20 +2065,121 @@ bool PrefetcherCodegenPass::runOnModule(llvm::Module &CurMod) {
 		llvm::BasicBlock &bb = mainFn->getEntryBlock();
 		llvm::Instruction *I = bb.getFirstNonPHIOrDbg();
 
-		pfcg.emitCreateParams(*I, (int)totalNodesNum, emitted_traversal_edges.size());
+		// every thread of a parallel region adds a node for its part of each
+		// trigger node, with a copy of the edges of that node
+		pfcg.emitCreateParams(*I,
+				(int)(totalNodesNum + pfcg.fieldViewCount + pfcg.rangeTriggerCount * MaxThreads),
+				emitted_traversal_edges.size() +
+				(pfcg.rangeTriggerCount + pfcg.rangeTravEdgeCount) * MaxThreads);
 		pfcg.emitCreateEnable(*I);
 	}
 
+	pfcg.emitDIGTable();
+	pfcg.writeIdMap();
+
 	return hasModuleChanged;
+}
 
+bool PrefetcherCodegenPass::runOnModule(llvm::Module &CurMod) {
+	PrefetcherCodegenAnalyses A;
+
+	// all functions are analysed up front, the detection in parallel
+	PrefetcherModuleAnalysis pfas;
+	pfas.run(CurMod,
+			[this](llvm::Function &F) -> llvm::TargetLibraryInfo & {
+				return this->getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F);
+			},
+			[this](llvm::Function &F) -> llvm::ScalarEvolution & {
+				return this->getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+			});
+
+	A.getPFA = [&pfas](llvm::Function &F) {
+		return pfas.get(F);
+	};
+	A.getDT = [this](llvm::Function &F) -> llvm::DominatorTree & {
+		return this->getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+	};
+	A.getLI = [this](llvm::Function &F) -> llvm::LoopInfo & {
+		return this->getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+	};
+	A.getSE = [this](llvm::Function &F) -> llvm::ScalarEvolution & {
+		return this->getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+	};
+	A.getBFI = [this](llvm::Function &F) -> llvm::BlockFrequencyInfo & {
+		return this->getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+	};
+
+	return runPrefetcherCodegen(CurMod, A);
 }
+
 void PrefetcherCodegenPass::getAnalysisUsage(llvm::AnalysisUsage &AU) const {
-	AU.addRequiredTransitive<PrefetcherPass>();
+	AU.addRequired<TargetLibraryInfoWrapperPass>();
 	AU.addRequired<LoopInfoWrapperPass>();
 	AU.addRequired<DominatorTreeWrapperPass>();
+	AU.addRequired<ScalarEvolutionWrapperPass>();
+	if (HotLoops) {
+		AU.addRequired<BlockFrequencyInfoWrapperPass>();
+	}
 	AU.setPreservesCFG();
 
 	return;
 }
 
+// New pass manager version of PrefetcherCodegenPass. The per-function
+// analyses are cached by the FunctionAnalysisManager, so PrefetcherAnalysis
+// runs at most once per function.
+class ProdigyPass : public llvm::PassInfoMixin<ProdigyPass> {
+public:
+	llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM) {
+		auto &FAM = MAM.getResult<llvm::FunctionAnalysisManagerModuleProxy>(M).getManager();
+		PrefetcherCodegenAnalyses A;
+
+		A.getPFA = [&FAM](llvm::Function &F) {
+			return &FAM.getResult<PrefetcherAnalysis>(F);
+		};
+		A.getDT = [&FAM](llvm::Function &F) -> llvm::DominatorTree & {
+			return FAM.getResult<llvm::DominatorTreeAnalysis>(F);
+		};
+		A.getLI = [&FAM](llvm::Function &F) -> llvm::LoopInfo & {
+			return FAM.getResult<llvm::LoopAnalysis>(F);
+		};
+		A.getSE = [&FAM](llvm::Function &F) -> llvm::ScalarEvolution & {
+			return FAM.getResult<llvm::ScalarEvolutionAnalysis>(F);
+		};
+		A.getBFI = [&FAM](llvm::Function &F) -> llvm::BlockFrequencyInfo & {
+			return FAM.getResult<llvm::BlockFrequencyAnalysis>(F);
+		};
+
+		if (!runPrefetcherCodegen(M, A)) {
+			return llvm::PreservedAnalyses::all();
+		}
+
+		llvm::PreservedAnalyses PA;
+		PA.preserveSet<llvm::CFGAnalyses>();
+		return PA;
+	}
+};
+
 } // namespace
+
+// plugin registration for the new pass manager
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+	return {LLVM_PLUGIN_API_VERSION, "Prefetcher", LLVM_VERSION_STRING,
+		[](llvm::PassBuilder &PB) {
+			PB.registerAnalysisRegistrationCallback(
+					[](llvm::FunctionAnalysisManager &FAM) {
+						FAM.registerPass([] { return PrefetcherAnalysis(); });
+					});
+			PB.registerPipelineParsingCallback(
+					[](llvm::StringRef Name, llvm::ModulePassManager &MPM,
+							llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+						if (Name == "prodigy") {
+							MPM.addPass(ProdigyPass());
+							return true;
+						}
+						return false;
+					});
+		}};
+}
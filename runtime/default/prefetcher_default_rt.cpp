@@ -35,7 +35,894 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <pf_interface.h>
 #include <sim_api.h>
+#include <pf_flat_dig.h>
 #include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <unordered_set>
+#include <unordered_map>
+#include <map>
+#include <string>
+#include <cstring>
+#include <cinttypes>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <chrono>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+/**
+ * @brief Kind of an entry of a DIG table passed to register_dig_batch().
+ *        Must be kept in sync with DIGDescKind in the prefetcher codegen.
+ */
+enum pf_dig_desc_kind_t {
+	PF_DIG_DESC_NODE = 1,
+	PF_DIG_DESC_TRAV_EDGE,
+	PF_DIG_DESC_TRIG_EDGE,
+	PF_DIG_DESC_FIELD_VIEW
+};
+
+/**
+ * @brief Entry of a DIG table. The arguments are those of the
+ *        corresponding register_node_with_size(), register_trav_edge1(),
+ *        register_trig_edge1() or register_field_view() call. Entries whose first argument is 0
+ *        have not been reached by the program yet and are skipped.
+ */
+struct pf_dig_desc_t {
+	int64_t kind;
+	uint64_t arg0;
+	uint64_t arg1;
+	int64_t arg2;
+	int64_t arg3;
+};
+
+/**
+ * @brief Kind of an operation of a DIG delta.
+ */
+enum pf_dig_delta_kind_t {
+	PF_DIG_DELTA_ADD_NODE = 1,
+	PF_DIG_DELTA_ADD_TRAV_EDGE,
+	PF_DIG_DELTA_ADD_TRAV_EDGE_BY_ID,
+	PF_DIG_DELTA_ADD_TRIG_EDGE,
+	PF_DIG_DELTA_ADD_TRIG_EDGE_BY_ID,
+	PF_DIG_DELTA_DELETE_TRAV_EDGE,
+	PF_DIG_DELTA_DELETE_TRIG_EDGE,
+	PF_DIG_DELTA_CLEAR_TRAV_EDGES,
+	PF_DIG_DELTA_CLEAR_TRIG_EDGES
+};
+
+/**
+ * @brief Change made to the DIG since it was last pushed to the
+ *        simulator. The arguments are those of the pf_params_t call that
+ *        made the change, in the same order.
+ */
+struct pf_dig_delta_op_t {
+	int64_t kind;
+	uint64_t arg0;
+	uint64_t arg1;
+	int64_t arg2;
+	int64_t arg3;
+};
+
+/**
+ * @brief Changes passed to the simulator by sim_user_pf_update(), to be
+ *        applied in order to the DIG it received last.
+ */
+struct pf_dig_delta_t {
+	const pf_dig_delta_op_t *ops;
+	int64_t count;
+};
+
+/*
+ * DIG snapshot file, written by pf_save_snapshot() and mapped by
+ * pf_load_snapshot(). Every address is stored as a node id and an offset
+ * into that node, so that a later run of the same program can rebase the
+ * snapshot onto its own allocations as they are registered. The file is
+ * the header followed by the views, traversal edges and trigger edges,
+ * all made of naturally aligned 64-bit fields, and is used in place.
+ */
+
+#define PF_SNAPSHOT_MAGIC "PFDIGSNP"
+#define PF_SNAPSHOT_VERSION 1
+
+struct pf_snapshot_header_t {
+	char magic[8];
+	uint64_t version;
+	uint64_t num_views;
+	uint64_t num_trav_edges;
+	uint64_t num_trig_edges;
+};
+
+/**
+ * @brief Address offset bytes into the node registered with node_id.
+ */
+struct pf_snapshot_ref_t {
+	int64_t node_id;
+	int64_t offset;
+};
+
+struct pf_snapshot_view_t {
+	pf_snapshot_ref_t base;
+	int64_t field_offset;
+	int64_t stride;
+	int64_t node_id;
+};
+
+/**
+ * @brief Traversal or trigger edge. arg is the id of a traversal edge and
+ *        the squash function of a trigger edge. Edges registered by node
+ *        id keep the ids in from and to, with offsets of 0.
+ */
+struct pf_snapshot_edge_t {
+	pf_snapshot_ref_t from;
+	pf_snapshot_ref_t to;
+	int64_t f;
+	int64_t arg;
+	int64_t by_node_id;
+};
+
+namespace {
+
+struct staged_node_t {
+	uintptr_t base;
+	int64_t size;
+	int64_t elem_size;
+	int64_t node_id;
+};
+
+struct staged_field_view_t {
+	uintptr_t base;
+	int64_t field_offset;
+	int64_t stride;
+	int64_t node_id;
+};
+
+struct staged_edge_t {
+	uintptr_t baseaddr_from;
+	uintptr_t baseaddr_to;
+	NodeId id_from;
+	NodeId id_to;
+	FuncId f;
+	FuncId sq_f;
+	int id;
+	bool by_node_id;
+};
+
+/**
+ * @brief Trigger edge on the elements [begin, end) of a node, which one
+ *        thread iterates over in a parallel loop.
+ */
+struct staged_trig_range_t {
+	uintptr_t base;
+	int64_t begin;
+	int64_t end;
+	FuncId f;
+	FuncId sq_f;
+
+	bool operator==(const staged_trig_range_t &other) const {
+		return base == other.base && begin == other.begin && end == other.end &&
+			f == other.f && sq_f == other.sq_f;
+	}
+};
+
+/**
+ * @brief Identity of a traversal edge: repeat registrations of the same
+ *        (from, to, func) triple are dropped.
+ */
+struct trav_edge_key_t {
+	uint64_t from;
+	uint64_t to;
+	int64_t f;
+	bool by_node_id;
+
+	bool operator==(const trav_edge_key_t &other) const {
+		return from == other.from && to == other.to && f == other.f &&
+			by_node_id == other.by_node_id;
+	}
+};
+
+struct trav_edge_key_hash_t {
+	size_t operator()(const trav_edge_key_t &k) const {
+		size_t h = std::hash<uint64_t>()(k.from);
+		h = h * 31 + std::hash<uint64_t>()(k.to);
+		h = h * 31 + std::hash<int64_t>()(k.f);
+		return h * 2 + k.by_node_id;
+	}
+};
+
+using trav_edge_set_t = std::unordered_set<trav_edge_key_t, trav_edge_key_hash_t>;
+
+trav_edge_key_t get_trav_edge_key(const staged_edge_t &e)
+{
+	if (e.by_node_id) {
+		return {(uint64_t) e.id_from, (uint64_t) e.id_to, e.f, true};
+	}
+	return {e.baseaddr_from, e.baseaddr_to, e.f, false};
+}
+
+// nodes and edges merged into the DIG, only accessed while merging and
+// by the delete, clear, snapshot and sampling entry points
+pf_flat_dig_t merged_dig;
+
+// traversal edges in merged_dig, so that repeat registrations are dropped
+trav_edge_set_t merged_trav_edge_keys;
+
+// field views merged into the DIG, kept for snapshots
+std::vector<staged_field_view_t> merged_field_views;
+
+// changes to the DIG since the last push to the simulator, and whether
+// there was one, only accessed while merging and by the push, delete and
+// clear entry points
+std::vector<pf_dig_delta_op_t> dig_delta;
+bool dig_pushed = false;
+
+/**
+ * @brief Part of a trigger node that one core iterates over. Unless it
+ *        starts at the base of the node, it is registered as a node nested
+ *        in it, with a trigger edge and a copy of the traversal edges of
+ *        the node, so that the prefetches of each core stay within its
+ *        own part.
+ */
+struct core_slice_t {
+	uintptr_t base;
+	int64_t size;
+};
+
+// DIG view of each core: the active slice of each trigger node, by the
+// base of the node. Only accessed while merging and by the clear entry
+// points
+std::vector<std::unordered_map<uintptr_t, core_slice_t>> core_views;
+
+// capacity given to create_params(), which slices are not registered past
+int64_t node_capacity = 0;
+int64_t trav_edge_capacity = 0;
+int64_t trig_edge_capacity = 0;
+
+// id of the next slice node, above the id of every merged node
+int64_t next_slice_node_id = 0;
+
+void record_delta(pf_dig_delta_kind_t kind, uint64_t arg0 = 0, uint64_t arg1 = 0,
+		int64_t arg2 = 0, int64_t arg3 = 0)
+{
+	// a clear supersedes the earlier changes to the same edges
+	if (kind == PF_DIG_DELTA_CLEAR_TRAV_EDGES || kind == PF_DIG_DELTA_CLEAR_TRIG_EDGES) {
+		bool trav = kind == PF_DIG_DELTA_CLEAR_TRAV_EDGES;
+		dig_delta.erase(std::remove_if(dig_delta.begin(), dig_delta.end(),
+					[&](const pf_dig_delta_op_t &op) {
+						return op.kind == (trav ? PF_DIG_DELTA_ADD_TRAV_EDGE : PF_DIG_DELTA_ADD_TRIG_EDGE) ||
+							op.kind == (trav ? PF_DIG_DELTA_ADD_TRAV_EDGE_BY_ID : PF_DIG_DELTA_ADD_TRIG_EDGE_BY_ID) ||
+							op.kind == (trav ? PF_DIG_DELTA_DELETE_TRAV_EDGE : PF_DIG_DELTA_DELETE_TRIG_EDGE) ||
+							op.kind == kind;
+					}), dig_delta.end());
+	}
+
+	dig_delta.push_back({kind, arg0, arg1, arg2, arg3});
+}
+
+/**
+ * @brief Snapshot mapped by pf_load_snapshot(). Its entries are merged
+ *        once the nodes they refer to are, and replace the edge and
+ *        view registrations of the program.
+ */
+struct dig_snapshot_t {
+	void *map;
+	size_t length;
+	const pf_snapshot_view_t *views;
+	const pf_snapshot_edge_t *trav_edges;
+	const pf_snapshot_edge_t *trig_edges;
+	const pf_snapshot_header_t *header;
+	// entries already merged: views, then traversal, then trigger edges
+	std::vector<bool> merged;
+};
+
+// set before registration starts, and not changed afterwards
+dig_snapshot_t *dig_snapshot = nullptr;
+
+/**
+ * @brief Counters of a candidate traversal edge, collected by the edge
+ *        profiling hooks.
+ */
+struct edge_profile_t {
+	// executions of the source access
+	uint64_t exercised = 0;
+	// executions of the target access
+	uint64_t accesses = 0;
+	// target accesses to a cache line that is neither the last one nor the
+	// one after it, an estimate of the misses the edge would cover
+	uint64_t misses = 0;
+	uintptr_t last_line = 0;
+};
+
+constexpr int cache_line_shift = 6;
+
+// set once the first edge table is registered
+std::atomic<bool> edge_profiling{false};
+
+// number of profiled edges, read by the profiling hooks without locking
+std::mutex edge_keys_mutex;
+std::atomic<int64_t> num_profiled_edges{0};
+
+/**
+ * @brief Keys of the profiled edges of every module, by edge index.
+ *        Modules register them from constructors that may run before the
+ *        static initialisers of the runtime, and the profile is written
+ *        at exit, so the keys are neither initialised nor destroyed
+ *        statically.
+ */
+std::vector<int64_t> &get_edge_keys()
+{
+	static std::vector<int64_t> *edge_keys = new std::vector<int64_t>();
+	return *edge_keys;
+}
+
+/**
+ * @brief Registrations of a single thread, waiting to be merged
+ *        into the DIG. Each buffer is only written by its owning
+ *        thread, so registration needs no synchronisation.
+ */
+struct staging_buffer_t {
+	std::vector<staged_node_t> nodes;
+	std::vector<staged_field_view_t> field_views;
+	std::vector<staged_edge_t> trav_edges;
+	std::vector<staged_edge_t> trig_edges;
+	std::vector<staged_trig_range_t> trig_ranges;
+	// traversal edges staged since the last merge
+	trav_edge_set_t seen_trav_edges;
+	// edge profile counters of this thread, by edge index
+	std::vector<edge_profile_t> edge_profile;
+	// order in which the thread first registered, which picks its core
+	int thread_index = 0;
+	staging_buffer_t *next = nullptr;
+};
+
+// lock-free list of all staging buffers, pushed to once per thread
+std::atomic<staging_buffer_t *> staging_buffers{nullptr};
+
+struct dig_table_t {
+	pf_dig_desc_t *descs;
+	int64_t count;
+	dig_table_t *next;
+};
+
+// lock-free list of the DIG tables registered by each module
+std::atomic<dig_table_t *> dig_tables{nullptr};
+
+template <typename Visitor>
+void for_each_dig_desc(int64_t kind, Visitor visit)
+{
+	for (dig_table_t *t = dig_tables.load(std::memory_order_acquire); t; t = t->next) {
+		for (int64_t i = 0; i < t->count; ++i) {
+			pf_dig_desc_t &d = t->descs[i];
+
+			if (d.kind == kind && d.arg0) {
+				visit(d);
+				// registered again only if the program reaches it again
+				d.arg0 = 0;
+			}
+		}
+	}
+}
+
+staging_buffer_t &get_staging_buffer()
+{
+	thread_local staging_buffer_t *buffer = nullptr;
+	static std::atomic<int> num_threads{0};
+
+	if (!buffer) {
+		// buffers outlive their threads so that registrations of
+		// threads that already exited are still merged
+		buffer = new staging_buffer_t();
+		buffer->thread_index = num_threads.fetch_add(1, std::memory_order_relaxed);
+		buffer->next = staging_buffers.load(std::memory_order_relaxed);
+		while (!staging_buffers.compare_exchange_weak(buffer->next, buffer,
+					std::memory_order_release, std::memory_order_relaxed)) {
+		}
+	}
+
+	return *buffer;
+}
+
+void stage_trav_edge(const staged_edge_t &e)
+{
+	staging_buffer_t &buffer = get_staging_buffer();
+
+	// registrations inside loops repeat the same edge on every iteration
+	if (buffer.seen_trav_edges.insert(get_trav_edge_key(e)).second) {
+		buffer.trav_edges.push_back(e);
+	}
+}
+
+/**
+ * @brief Computes the node of a field view: one field of each element
+ *        of the merged node containing v.base, starting field_offset
+ *        bytes into the first element with one stride bytes large
+ *        element per struct.
+ * @retval false if base is not in a merged node, or a node already
+ *         starts at the field
+ */
+bool get_field_view(const staged_field_view_t &v, staged_node_t &view)
+{
+	uint32_t n = merged_dig.find_node(v.base);
+	if (n == pf_flat_dig_t::npos) {
+		return false;
+	}
+
+	uintptr_t end = merged_dig.node_base[n] + merged_dig.node_size[n];
+	uintptr_t view_base = v.base + v.field_offset;
+
+	if (view_base >= end || merged_dig.find_node_base(view_base) != pf_flat_dig_t::npos) {
+		return false;
+	}
+
+	view = {view_base, (int64_t) (end - view_base), v.stride, v.node_id};
+	return true;
+}
+
+/**
+ * @brief Position-independent form of addr: the merged node containing
+ *        it and the offset into that node.
+ * @retval false if addr is not in a merged node
+ */
+bool get_snapshot_ref(uintptr_t addr, pf_snapshot_ref_t &ref)
+{
+	uint32_t n = merged_dig.find_node(addr);
+	if (n == pf_flat_dig_t::npos) {
+		return false;
+	}
+
+	ref = {merged_dig.node_id[n], (int64_t) (addr - merged_dig.node_base[n])};
+	return true;
+}
+
+/**
+ * @brief Address of ref in this run.
+ * @retval false if its node has not been merged yet
+ */
+bool get_snapshot_addr(const pf_snapshot_ref_t &ref, uintptr_t &addr)
+{
+	uint32_t n = merged_dig.find_node_id(ref.node_id);
+	if (n == pf_flat_dig_t::npos) {
+		return false;
+	}
+
+	addr = merged_dig.node_base[n] + ref.offset;
+	return true;
+}
+
+bool get_snapshot_edge(uint64_t from, uint64_t to, int64_t f, int64_t arg,
+		bool by_node_id, pf_snapshot_edge_t &s)
+{
+	s = {{(int64_t) from, 0}, {(int64_t) to, 0}, f, arg, by_node_id};
+
+	return by_node_id || (get_snapshot_ref(from, s.from) && get_snapshot_ref(to, s.to));
+}
+
+/**
+ * @brief Rebases a snapshot edge onto this run.
+ * @retval false if one of its nodes has not been merged yet
+ */
+bool get_staged_edge(const pf_snapshot_edge_t &s, staged_edge_t &e)
+{
+	e = {0, 0, NodeId(), NodeId(), (FuncId) s.f, (FuncId) s.arg, (int) s.arg, (bool) s.by_node_id};
+
+	if (s.by_node_id) {
+		e.id_from = s.from.node_id;
+		e.id_to = s.to.node_id;
+		return true;
+	}
+
+	return get_snapshot_addr(s.from, e.baseaddr_from) && get_snapshot_addr(s.to, e.baseaddr_to);
+}
+
+/**
+ * @brief Removes the edges registered by address from baseaddr_from to
+ *        baseaddr_to from merged_dig. Only the edges of the from node are
+ *        searched, and the edges are left as they are if none matches.
+ */
+void delete_merged_edges(pf_flat_dig_t::edges_t &edges, uintptr_t baseaddr_from,
+		uintptr_t baseaddr_to)
+{
+	auto matches = [&](const pf_flat_dig_t::edges_t &e, size_t i) {
+		return !e.by_node_id[i] && e.from[i] == baseaddr_from && e.to[i] == baseaddr_to;
+	};
+
+	auto range = merged_dig.get_edges(edges, merged_dig.find_node_base(baseaddr_from));
+	bool found = false;
+	for (uint32_t i = range.first; i < range.second && !found; ++i) {
+		found = matches(edges, i);
+	}
+
+	if (!found) {
+		return;
+	}
+
+	merged_dig.remove_edges(edges, [&](const pf_flat_dig_t::edges_t &e, size_t i) {
+		if (!matches(e, i)) {
+			return false;
+		}
+		if (&e == &merged_dig.trav) {
+			merged_trav_edge_keys.erase({e.from[i], e.to[i], e.f[i], false});
+		}
+		return true;
+	});
+}
+
+/**
+ * @brief Number of cores the prefetcher is configured for. Taken from
+ *        PF_NUM_CORES if set, otherwise from the simulator or, in native
+ *        runs, from the number of hardware threads.
+ */
+int get_num_cores()
+{
+	if (const char *env = std::getenv("PF_NUM_CORES")) {
+		int cores = std::atoi(env);
+		if (cores > 0) {
+			return cores;
+		}
+	}
+
+	if (SimInSimulator()) {
+		return SimGetNumProcs();
+	}
+
+	unsigned int cores = std::thread::hardware_concurrency();
+	return cores ? cores : 1;
+}
+
+
+/*
+ * Sampling of demand loads outside the simulator, enabled by setting
+ * PF_SAMPLE_PERIOD. Loads are sampled with the PEBS load latency event
+ * where the CPU advertises it, with the precise L1D read miss event
+ * otherwise, and with page faults, the only software event that records
+ * data addresses, as a last resort. A reader thread drains the per-CPU
+ * sample buffers while the region of interest runs.
+ */
+
+/**
+ * @brief What the samples of the opened event tell about a load.
+ */
+enum pf_sample_kind_t {
+	PF_SAMPLE_LOADS,   // any load, with its data source and latency
+	PF_SAMPLE_MISSES,  // L1D read misses only, without latency
+	PF_SAMPLE_TOUCHES  // page faults, neither misses nor latency
+};
+
+struct pf_sample_t {
+	uint64_t addr;
+	uint64_t weight;
+	uint64_t data_src;
+};
+
+struct sampler_t {
+	const char *event;
+	uint64_t period;
+	pf_sample_kind_t kind;
+	std::vector<int> fds;
+	std::vector<void *> rings;
+	size_t ring_size;
+	std::vector<pf_sample_t> samples;
+	uint64_t lost = 0;
+	std::thread reader;
+	std::atomic<bool> stop{false};
+};
+
+constexpr size_t sample_ring_pages = 64;
+
+sampler_t *sampler = nullptr;
+
+/**
+ * @brief Fills in attr with the PEBS load latency event, if the CPU
+ *        advertises one ("event=0xcd,umask=0x1,ldlat=3" on Intel).
+ */
+bool get_load_latency_event(perf_event_attr &attr)
+{
+	std::ifstream desc("/sys/bus/event_source/devices/cpu/events/mem-loads");
+	std::ifstream type("/sys/bus/event_source/devices/cpu/type");
+	std::string fields;
+	uint32_t pmu_type;
+
+	if (!(desc >> fields) || !(type >> pmu_type)) {
+		return false;
+	}
+
+	uint64_t event = 0, umask = 0, ldlat = 3;
+	size_t pos = 0;
+	while (pos < fields.size()) {
+		size_t end = fields.find(',', pos);
+		std::string field = fields.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+		size_t eq = field.find('=');
+
+		if (eq != std::string::npos) {
+			uint64_t value = std::strtoull(field.c_str() + eq + 1, nullptr, 0);
+			std::string name = field.substr(0, eq);
+			if (name == "event") {
+				event = value;
+			}
+			else if (name == "umask") {
+				umask = value;
+			}
+			else if (name == "ldlat") {
+				ldlat = value;
+			}
+		}
+
+		pos = end == std::string::npos ? fields.size() : end + 1;
+	}
+
+	if (!event) {
+		return false;
+	}
+
+	attr.type = pmu_type;
+	attr.config = event | (umask << 8);
+	attr.config1 = ldlat;
+	attr.precise_ip = 2;
+	return true;
+}
+
+void read_ring(const char *data, size_t size, uint64_t offset, void *dst, size_t len)
+{
+	char *out = static_cast<char *>(dst);
+	for (size_t i = 0; i < len; ++i) {
+		out[i] = data[(offset + i) % size];
+	}
+}
+
+void drain_ring(sampler_t &s, void *ring)
+{
+	auto *meta = static_cast<perf_event_mmap_page *>(ring);
+	const char *data = static_cast<const char *>(ring) + sysconf(_SC_PAGESIZE);
+	uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = meta->data_tail;
+
+	while (tail < head) {
+		perf_event_header hdr;
+		read_ring(data, s.ring_size, tail, &hdr, sizeof(hdr));
+
+		if (hdr.type == PERF_RECORD_SAMPLE) {
+			pf_sample_t sample;
+			read_ring(data, s.ring_size, tail + sizeof(hdr), &sample, sizeof(sample));
+			s.samples.push_back(sample);
+		}
+		else if (hdr.type == PERF_RECORD_LOST) {
+			uint64_t lost[2];
+			read_ring(data, s.ring_size, tail + sizeof(hdr), lost, sizeof(lost));
+			s.lost += lost[1];
+		}
+
+		tail += hdr.size;
+	}
+
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Opens attr on every CPU it can be opened on and maps its buffers.
+ * @retval false if it could not be opened on any CPU
+ */
+bool open_sampling_event(sampler_t &s, perf_event_attr &attr)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	for (long cpu = 0; cpu < cpus; ++cpu) {
+		int fd = syscall(SYS_perf_event_open, &attr, 0, (int) cpu, -1, PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			continue;
+		}
+
+		void *ring = mmap(nullptr, page_size + s.ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+		if (ring == MAP_FAILED) {
+			close(fd);
+			continue;
+		}
+
+		s.fds.push_back(fd);
+		s.rings.push_back(ring);
+	}
+
+	return !s.fds.empty();
+}
+
+/**
+ * @brief Samples the loads of this process, and of the threads it starts
+ *        from now on, on every CPU.
+ * @retval false if no sampling event could be opened
+ */
+bool start_sampling(uint64_t period)
+{
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sample_period = period;
+	// the sample record layout is that of pf_sample_t
+	attr.sample_type = PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	sampler_t *s = new sampler_t();
+	s->period = period;
+	s->ring_size = sample_ring_pages * sysconf(_SC_PAGESIZE);
+
+	s->kind = PF_SAMPLE_LOADS;
+	s->event = "mem-loads";
+	bool opened = get_load_latency_event(attr) && open_sampling_event(*s, attr);
+
+	if (!opened) {
+		s->kind = PF_SAMPLE_MISSES;
+		s->event = "L1-dcache-load-misses";
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+				(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.config1 = 0;
+		// without a precise event the sampled addresses are not those of the loads
+		attr.precise_ip = 2;
+		opened = open_sampling_event(*s, attr);
+	}
+
+	if (!opened) {
+		s->kind = PF_SAMPLE_TOUCHES;
+		s->event = "page-faults";
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+		attr.precise_ip = 0;
+		opened = open_sampling_event(*s, attr);
+	}
+
+	if (!opened) {
+		delete s;
+		return false;
+	}
+
+	s->reader = std::thread([s] {
+		while (!s->stop.load(std::memory_order_acquire)) {
+			for (void *ring : s->rings) {
+				drain_ring(*s, ring);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	});
+
+	sampler = s;
+	return true;
+}
+
+/**
+ * @brief Stops sampling and collects the remaining samples.
+ */
+void stop_sampling(sampler_t &s)
+{
+	s.stop.store(true, std::memory_order_release);
+	s.reader.join();
+
+	for (size_t i = 0; i < s.fds.size(); ++i) {
+		drain_ring(s, s.rings[i]);
+		munmap(s.rings[i], sysconf(_SC_PAGESIZE) + s.ring_size);
+		close(s.fds[i]);
+	}
+	s.fds.clear();
+	s.rings.clear();
+}
+
+/**
+ * @brief Samples attributed to a DIG node. Loads served from beyond the
+ *        L1 (or the line fill buffer) count as misses; L1D miss samples
+ *        all do.
+ */
+struct node_samples_t {
+	uint64_t samples = 0;
+	uint64_t misses = 0;
+	uint64_t latency = 0;
+};
+
+bool is_sampled_miss(const sampler_t &s, const pf_sample_t &sample)
+{
+	if (s.kind == PF_SAMPLE_MISSES) {
+		return true;
+	}
+
+	perf_mem_data_src src;
+	src.val = sample.data_src;
+	return !(src.mem_lvl & PERF_MEM_LVL_HIT) ||
+		!(src.mem_lvl & (PERF_MEM_LVL_L1 | PERF_MEM_LVL_LFB));
+}
+
+/**
+ * @brief Writes the samples, misses and average latency columns of a node
+ *        or edge line, with "-" for what the sampled event does not record.
+ */
+void write_sample_columns(const sampler_t &s, const node_samples_t &ns, FILE *f)
+{
+	fprintf(f, " %" PRIu64, ns.samples);
+
+	if (s.kind == PF_SAMPLE_TOUCHES) {
+		fprintf(f, " -");
+	}
+	else {
+		fprintf(f, " %" PRIu64, ns.misses);
+	}
+
+	if (s.kind != PF_SAMPLE_LOADS) {
+		fprintf(f, " -\n");
+	}
+	else {
+		fprintf(f, " %.1f\n", ns.samples ? (double) ns.latency / ns.samples : 0.0);
+	}
+}
+
+/**
+ * @brief Attributes the samples to the merged nodes by address range and
+ *        writes one line per node and per traversal edge, the latter with
+ *        the samples of its target node, the loads the edge prefetches.
+ */
+void write_sampling_report(const sampler_t &s, FILE *f)
+{
+	merged_dig.index();
+
+	std::vector<node_samples_t> nodes(merged_dig.num_nodes());
+	uint64_t unattributed = 0;
+
+	for (const pf_sample_t &sample : s.samples) {
+		uint32_t n = merged_dig.find_node(sample.addr);
+		if (n == pf_flat_dig_t::npos) {
+			unattributed++;
+			continue;
+		}
+
+		node_samples_t &ns = nodes[n];
+		ns.samples++;
+		ns.misses += is_sampled_miss(s, sample);
+		ns.latency += sample.weight;
+	}
+
+	fprintf(f, "# event %s period %" PRIu64 " samples %zu lost %" PRIu64 " outside nodes %" PRIu64 "\n",
+			s.event, s.period, s.samples.size(), s.lost, unattributed);
+	if (s.kind == PF_SAMPLE_TOUCHES) {
+		fprintf(f, "# touch-only: page faults record neither misses nor latency\n");
+	}
+
+	fprintf(f, "# node id base size samples misses avg_latency\n");
+	for (size_t n = 0; n < nodes.size(); ++n) {
+		const node_samples_t &ns = nodes[n];
+		if (!ns.samples) {
+			continue;
+		}
+		fprintf(f, "node %" PRId64 " 0x%" PRIxPTR " %" PRId64,
+				merged_dig.node_id[n], merged_dig.node_base[n], merged_dig.node_size[n]);
+		write_sample_columns(s, ns, f);
+	}
+
+	fprintf(f, "# edge id from_node to_node target_samples target_misses target_avg_latency\n");
+	const pf_flat_dig_t::edges_t &trav = merged_dig.trav;
+	for (size_t i = 0; i < trav.size(); ++i) {
+		uint32_t from = trav.src[i];
+		uint32_t to = trav.dst[i];
+
+		// edges into a field, or from an address past the base of a node
+		if (!trav.by_node_id[i]) {
+			from = merged_dig.find_node(trav.from[i]);
+			to = merged_dig.find_node(trav.to[i]);
+		}
+
+		if (from == pf_flat_dig_t::npos || to == pf_flat_dig_t::npos) {
+			continue;
+		}
+
+		fprintf(f, "edge %d %" PRId64 " %" PRId64,
+				(int) trav.arg[i], merged_dig.node_id[from], merged_dig.node_id[to]);
+		write_sample_columns(s, nodes[to], f);
+	}
+}
+
+} // namespace
 
 extern "C" {
 
@@ -50,7 +937,17 @@ int register_trav_edge2(NodeId id_from, NodeId id_to, FuncId f);
 int register_trig_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f,
                        FuncId sq_f);
 int register_trig_edge2(NodeId id_from, NodeId id_to, FuncId f, FuncId sq_f);
+int register_trig_edge_range(uintptr_t base, int64_t begin, int64_t end, FuncId f,
+                             FuncId sq_f);
+int register_dig_batch(pf_dig_desc_t *descs, int64_t count);
+int register_field_view(uintptr_t base, int64_t field_offset, int64_t stride,
+                        int64_t node_id);
+int pf_save_snapshot(const char *path);
+int pf_load_snapshot(const char *path);
+int pf_merge_staged();
+int pf_trigger_access(uintptr_t addr);
 int sim_user_pf_set_param();
+int sim_user_pf_update();
 int sim_user_pf_set_enable();
 int sim_user_pf_enable();
 int sim_user_wait();
@@ -62,9 +959,12 @@ int delete_enable();
 void c_print_verify();
 
 // Profile
-int register_identify_edge(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f);
-int register_identify_edge_source(uintptr_t baseaddr_from, int edge_id);
-int register_identify_edge_target(uintptr_t baseaddr_to, int edge_id);
+int register_identify_edge(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f,
+                           int64_t edge_id);
+int register_identify_edge_source(uintptr_t baseaddr_from, int64_t edge_index);
+int register_identify_edge_target(uintptr_t baseaddr_to, int64_t edge_index);
+int register_identify_edge_table(const int64_t *keys, int64_t count, int64_t *first_index);
+int pf_dump_edge_profile();
 
 
 pf_params_t * params;
@@ -73,6 +973,7 @@ pf_enable_t * enable;
 int
 print_params()
 {
+	pf_merge_staged();
 	params->Print();
 	return 0;
 }
@@ -80,8 +981,21 @@ print_params()
 int create_params(int num_nodes_pf, int num_edges_pf, int num_triggers_pf)
 {
 	int params_id = 0;
-	params = new pf_params_t(num_nodes_pf, num_edges_pf, num_triggers_pf, 1); // KUBA CHANGE THIS: Update last parameter to reflect cores
-	printf("****pf: &params = %p %d %d %d\n", params, num_nodes_pf, num_edges_pf, num_triggers_pf);
+	int num_cores = get_num_cores();
+	params = new pf_params_t(num_nodes_pf, num_edges_pf, num_triggers_pf, num_cores);
+	printf("****pf: &params = %p %d %d %d %d\n", params, num_nodes_pf, num_edges_pf, num_triggers_pf, num_cores);
+
+	core_views.resize(num_cores);
+	node_capacity = num_nodes_pf;
+	trav_edge_capacity = num_edges_pf;
+	trig_edge_capacity = num_triggers_pf;
+
+	// reuse the DIG of an earlier run if there is one, it is saved otherwise
+	if (const char *path = std::getenv("PF_DIG_SNAPSHOT")) {
+		if (pf_load_snapshot(path) == 0) {
+			printf("****pf: loaded DIG snapshot %s\n", path);
+		}
+	}
 
 	return params_id;
 }
@@ -105,15 +1019,460 @@ int create_enable()
 //	return err;
 //}
 
+/**
+ * @brief Merges the registrations staged by all threads, and the
+ *        reached entries of all DIG tables, into the DIG.
+ *        Nodes, and then the field views of them, are merged before
+ *        edges, so that edges can refer to nodes registered by any thread.
+ *        The trigger edges of parallel loops are merged last, into the
+ *        DIG view of the core of each registering thread, the n-th thread
+ *        to register running on core n modulo the number of cores.
+ *        NOTE: Registering threads must have finished (e.g. joined or past
+ *              a barrier) before this is called, as is already required
+ *              for sim_user_pf_set_param()
+ * @retval Int 0 on success
+ */
+int
+pf_merge_staged()
+{
+	staging_buffer_t *head = staging_buffers.load(std::memory_order_acquire);
+	dig_snapshot_t *snapshot = dig_snapshot;
+
+	auto merge_node = [](const staged_node_t &n) {
+		params->RegisterNodeWithSize(n.base, n.size, n.elem_size, n.node_id);
+		merged_dig.add_node(n.base, n.size, n.elem_size, n.node_id);
+		record_delta(PF_DIG_DELTA_ADD_NODE, n.base, n.size, n.elem_size, n.node_id);
+		next_slice_node_id = std::max(next_slice_node_id, n.node_id + 1);
+	};
+
+	auto merge_field_view = [&](const staged_field_view_t &v) {
+		staged_node_t view;
+		if (get_field_view(v, view)) {
+			merge_node(view);
+			merged_field_views.push_back(v);
+		}
+	};
+
+	auto merge_trav_edge = [](const staged_edge_t &e) {
+		trav_edge_key_t key = get_trav_edge_key(e);
+		if (!merged_trav_edge_keys.insert(key).second) {
+			return;
+		}
+		merged_dig.add_edge(merged_dig.trav, key.from, key.to, e.f, e.id, e.by_node_id);
+
+		if (e.by_node_id) {
+			(void) params->RegisterTravEdge(e.id_from, e.id_to, e.f);
+			record_delta(PF_DIG_DELTA_ADD_TRAV_EDGE_BY_ID, e.id_from, e.id_to, e.f);
+		}
+		else {
+			(void) params->RegisterTravEdge(e.baseaddr_from, e.baseaddr_to, e.f, e.id);
+			record_delta(PF_DIG_DELTA_ADD_TRAV_EDGE, e.baseaddr_from, e.baseaddr_to, e.f, e.id);
+		}
+	};
+
+	auto merge_trig_edge = [](const staged_edge_t &e) {
+		if (e.by_node_id) {
+			params->RegisterTrigEdge(e.id_from, e.id_to, e.f, e.sq_f);
+			record_delta(PF_DIG_DELTA_ADD_TRIG_EDGE_BY_ID, e.id_from, e.id_to, e.f, e.sq_f);
+		}
+		else {
+			params->RegisterTrigEdge(e.baseaddr_from, e.baseaddr_to, e.f, e.sq_f);
+			record_delta(PF_DIG_DELTA_ADD_TRIG_EDGE, e.baseaddr_from, e.baseaddr_to, e.f, e.sq_f);
+		}
+		merged_dig.add_edge(merged_dig.trig,
+				e.by_node_id ? (uint64_t) e.id_from : e.baseaddr_from,
+				e.by_node_id ? (uint64_t) e.id_to : e.baseaddr_to, e.f, e.sq_f, e.by_node_id);
+	};
+
+	// removes the edges of a slice no core iterates over anymore; the node
+	// itself stays registered, so that it is reused if the slice comes back
+	auto retire_slice = [](uintptr_t base) {
+		for (auto &view : core_views) {
+			for (auto &s : view) {
+				if (s.second.base == base) {
+					return;
+				}
+			}
+		}
+
+		std::vector<uintptr_t> targets;
+		auto trav = merged_dig.get_edges(merged_dig.trav, merged_dig.find_node_base(base));
+		for (uint32_t i = trav.first; i < trav.second; ++i) {
+			if (!merged_dig.trav.by_node_id[i]) {
+				targets.push_back(merged_dig.trav.to[i]);
+			}
+		}
+
+		for (uintptr_t to : targets) {
+			params->DeleteTravEdge(base, to);
+			delete_merged_edges(merged_dig.trav, base, to);
+			record_delta(PF_DIG_DELTA_DELETE_TRAV_EDGE, base, to);
+		}
+
+		params->DeleteTrigEdge(base, base);
+		delete_merged_edges(merged_dig.trig, base, base);
+		record_delta(PF_DIG_DELTA_DELETE_TRIG_EDGE, base, base);
+	};
+
+	// makes the elements of a trigger node iterated over by a thread the
+	// slice of that node in the view of the thread's core
+	auto merge_trig_range = [&](const staged_trig_range_t &r, int thread_index) {
+		uint32_t n = merged_dig.find_node_base(r.base);
+		if (n == pf_flat_dig_t::npos || core_views.empty()) {
+			return;
+		}
+
+		int64_t node_size = merged_dig.node_size[n];
+		int64_t elem_size = std::max<int64_t>(merged_dig.node_elem_size[n], 1);
+		int64_t begin = std::max<int64_t>(r.begin, 0);
+		int64_t end = std::min(r.end, node_size / elem_size);
+		if (begin >= end) {
+			return;
+		}
+
+		// the slice at the head of the node is the node itself
+		core_slice_t slice = {r.base + begin * elem_size,
+			begin ? (end - begin) * elem_size : node_size};
+
+		auto &view = core_views[thread_index % core_views.size()];
+		auto found = view.find(r.base);
+		if (found != view.end()) {
+			core_slice_t old = found->second;
+			view.erase(found);
+			if (old.base != r.base && old.base != slice.base) {
+				retire_slice(old.base);
+			}
+		}
+
+		std::vector<staged_edge_t> trav_edges;
+		auto trav = merged_dig.get_edges(merged_dig.trav, n);
+		for (uint32_t i = trav.first; i < trav.second && slice.base != r.base; ++i) {
+			if (!merged_dig.trav.by_node_id[i]) {
+				FuncId f = (FuncId) merged_dig.trav.f[i];
+				trav_edges.push_back({slice.base, merged_dig.trav.to[i], NodeId(), NodeId(),
+						f, f, (int) merged_dig.trav.arg[i], false});
+			}
+		}
+
+		uint32_t s = merged_dig.find_node_base(slice.base);
+		if (s == pf_flat_dig_t::npos || merged_dig.node_size[s] != slice.size) {
+			if ((int64_t) merged_dig.num_nodes() >= node_capacity) {
+				return;
+			}
+			merge_node({slice.base, slice.size, elem_size, next_slice_node_id});
+			s = merged_dig.find_node_base(slice.base);
+		}
+
+		// edges of the node registered after an earlier merge of the slice
+		// are copied now, the others are dropped as repeats
+		for (const staged_edge_t &e : trav_edges) {
+			if ((int64_t) merged_dig.trav.size() < trav_edge_capacity) {
+				merge_trav_edge(e);
+			}
+		}
+
+		auto trig = merged_dig.get_edges(merged_dig.trig, s);
+		if (trig.first == trig.second) {
+			if ((int64_t) merged_dig.trig.size() >= trig_edge_capacity) {
+				return;
+			}
+			merge_trig_edge({slice.base, slice.base, NodeId(), NodeId(), r.f, r.sq_f, 0, false});
+		}
+
+		view[r.base] = slice;
+	};
+
+	// merges the snapshot entries [begin, end) whose nodes are known
+	auto merge_snapshot = [&](uint64_t begin, uint64_t end, auto merge_entry) {
+		for (uint64_t i = begin; snapshot && i < end; ++i) {
+			if (!snapshot->merged[i]) {
+				snapshot->merged[i] = merge_entry(i - begin);
+			}
+		}
+	};
+
+	for_each_dig_desc(PF_DIG_DESC_NODE, [&](pf_dig_desc_t &d) {
+		merge_node({(uintptr_t) d.arg0, (int64_t) d.arg1, d.arg2, d.arg3});
+	});
+
+	for (staging_buffer_t *b = head; b; b = b->next) {
+		for (auto &n : b->nodes) {
+			merge_node(n);
+		}
+		b->nodes.clear();
+	}
+
+	for_each_dig_desc(PF_DIG_DESC_FIELD_VIEW, [&](pf_dig_desc_t &d) {
+		if (!snapshot) {
+			merge_field_view({(uintptr_t) d.arg0, (int64_t) d.arg1, d.arg2, d.arg3});
+		}
+	});
+
+	for (staging_buffer_t *b = head; b; b = b->next) {
+		for (auto &v : b->field_views) {
+			merge_field_view(v);
+		}
+		b->field_views.clear();
+	}
+
+	uint64_t num_views = snapshot ? snapshot->header->num_views : 0;
+	uint64_t num_trav = snapshot ? snapshot->header->num_trav_edges : 0;
+	uint64_t num_trig = snapshot ? snapshot->header->num_trig_edges : 0;
+
+	merge_snapshot(0, num_views, [&](uint64_t i) {
+		const pf_snapshot_view_t &v = snapshot->views[i];
+		uintptr_t base;
+		if (!get_snapshot_addr(v.base, base)) {
+			return false;
+		}
+		merge_field_view({base, v.field_offset, v.stride, v.node_id});
+		return true;
+	});
+
+	for_each_dig_desc(PF_DIG_DESC_TRAV_EDGE, [&](pf_dig_desc_t &d) {
+		if (!snapshot) {
+			merge_trav_edge({(uintptr_t) d.arg0, (uintptr_t) d.arg1, NodeId(), NodeId(),
+					(FuncId) d.arg2, (FuncId) d.arg2, (int) d.arg3, false});
+		}
+	});
+
+	for (staging_buffer_t *b = head; b; b = b->next) {
+		for (auto &e : b->trav_edges) {
+			merge_trav_edge(e);
+		}
+		b->trav_edges.clear();
+		b->seen_trav_edges.clear();
+	}
+
+	merge_snapshot(num_views, num_views + num_trav, [&](uint64_t i) {
+		staged_edge_t e;
+		if (!get_staged_edge(snapshot->trav_edges[i], e)) {
+			return false;
+		}
+		merge_trav_edge(e);
+		return true;
+	});
+
+	for_each_dig_desc(PF_DIG_DESC_TRIG_EDGE, [&](pf_dig_desc_t &d) {
+		if (!snapshot) {
+			merge_trig_edge({(uintptr_t) d.arg0, (uintptr_t) d.arg1, NodeId(), NodeId(),
+					(FuncId) d.arg2, (FuncId) d.arg3, 0, false});
+		}
+	});
+
+	for (staging_buffer_t *b = head; b; b = b->next) {
+		for (auto &e : b->trig_edges) {
+			merge_trig_edge(e);
+		}
+		b->trig_edges.clear();
+	}
+
+	merge_snapshot(num_views + num_trav, num_views + num_trav + num_trig, [&](uint64_t i) {
+		staged_edge_t e;
+		if (!get_staged_edge(snapshot->trig_edges[i], e)) {
+			return false;
+		}
+		merge_trig_edge(e);
+		return true;
+	});
+
+	for (staging_buffer_t *b = head; b; b = b->next) {
+		for (auto &r : b->trig_ranges) {
+			merge_trig_range(r, b->thread_index);
+		}
+		b->trig_ranges.clear();
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Writes the DIG built so far to a snapshot file that later runs
+ *        of the same program can map with pf_load_snapshot(). Edges and
+ *        views whose addresses are not inside a registered node are not
+ *        saved. The file is replaced atomically.
+ * @param path Snapshot file
+ * @retval Int 0 on success, -1 if the file could not be written
+ */
+int pf_save_snapshot(const char *path)
+{
+	pf_merge_staged();
+
+	std::vector<pf_snapshot_view_t> views;
+	std::vector<pf_snapshot_edge_t> trav_edges;
+	std::vector<pf_snapshot_edge_t> trig_edges;
+
+	for (auto &v : merged_field_views) {
+		pf_snapshot_view_t sv = {{0, 0}, v.field_offset, v.stride, v.node_id};
+		if (get_snapshot_ref(v.base, sv.base)) {
+			views.push_back(sv);
+		}
+	}
+
+	auto save_edges = [](const pf_flat_dig_t::edges_t &edges,
+			std::vector<pf_snapshot_edge_t> &saved) {
+		for (size_t i = 0; i < edges.size(); ++i) {
+			pf_snapshot_edge_t se;
+			if (get_snapshot_edge(edges.from[i], edges.to[i], edges.f[i], edges.arg[i],
+						edges.by_node_id[i], se)) {
+				saved.push_back(se);
+			}
+		}
+	};
+
+	save_edges(merged_dig.trav, trav_edges);
+	save_edges(merged_dig.trig, trig_edges);
+
+	pf_snapshot_header_t header;
+	std::memcpy(header.magic, PF_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = PF_SNAPSHOT_VERSION;
+	header.num_views = views.size();
+	header.num_trav_edges = trav_edges.size();
+	header.num_trig_edges = trig_edges.size();
+
+	std::string tmp_path = std::string(path) + ".tmp";
+	FILE *f = fopen(tmp_path.c_str(), "wb");
+	if (!f) {
+		return -1;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(views.data(), sizeof(pf_snapshot_view_t), views.size(), f) == views.size() &&
+		fwrite(trav_edges.data(), sizeof(pf_snapshot_edge_t), trav_edges.size(), f) == trav_edges.size() &&
+		fwrite(trig_edges.data(), sizeof(pf_snapshot_edge_t), trig_edges.size(), f) == trig_edges.size();
+
+	if (fclose(f) != 0 || !ok || rename(tmp_path.c_str(), path) != 0) {
+		unlink(tmp_path.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Maps a snapshot written by pf_save_snapshot(). Its edges and
+ *        views are merged into the DIG as soon as the nodes they refer to
+ *        are registered, and the edge and view registrations of the
+ *        program are dropped, so that setting up the DIG only costs the
+ *        node registrations.
+ *        NOTE: Must be called before any registration, and only with a
+ *              snapshot of the same program, whose node ids match
+ * @param path Snapshot file
+ * @retval Int 0 on success, -1 if there is no valid snapshot at path
+ */
+int pf_load_snapshot(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(pf_snapshot_header_t)) {
+		close(fd);
+		return -1;
+	}
+
+	size_t length = st.st_size;
+	void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	auto *header = static_cast<const pf_snapshot_header_t *>(map);
+	uint64_t num_edges = header->num_trav_edges + header->num_trig_edges;
+
+	if (std::memcmp(header->magic, PF_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != PF_SNAPSHOT_VERSION ||
+			length != sizeof(pf_snapshot_header_t) +
+				header->num_views * sizeof(pf_snapshot_view_t) +
+				num_edges * sizeof(pf_snapshot_edge_t)) {
+		munmap(map, length);
+		return -1;
+	}
+
+	dig_snapshot_t *snapshot = new dig_snapshot_t();
+	snapshot->map = map;
+	snapshot->length = length;
+	snapshot->header = header;
+	snapshot->views = reinterpret_cast<const pf_snapshot_view_t *>(header + 1);
+	snapshot->trav_edges = reinterpret_cast<const pf_snapshot_edge_t *>(
+			snapshot->views + header->num_views);
+	snapshot->trig_edges = snapshot->trav_edges + header->num_trav_edges;
+	snapshot->merged.assign(header->num_views + num_edges, false);
+
+	dig_snapshot = snapshot;
+
+	return 0;
+}
+
+/**
+ * @brief Registers a table of DIG nodes and edges. The program fills in
+ *        the addresses of each entry as it reaches the corresponding
+ *        allocation or access, and the table is read when the DIG is
+ *        merged, so a single call per module replaces the per-node and
+ *        per-edge register calls. Called from a module constructor
+ *        emitted by -prefetcher-codegen-mode=runtime-batched.
+ * @param descs Table entries
+ * @param count Number of entries
+ * @retval Int 0 on success
+ */
+int register_dig_batch(pf_dig_desc_t *descs, int64_t count)
+{
+	int err = 0;
+
+	dig_table_t *table = new dig_table_t{descs, count, nullptr};
+	table->next = dig_tables.load(std::memory_order_relaxed);
+	while (!dig_tables.compare_exchange_weak(table->next, table,
+				std::memory_order_release, std::memory_order_relaxed)) {
+	}
+
+	return err;
+}
+
+/*
+ * The register_* functions below may be called concurrently. They only
+ * append to the staging buffer of the calling thread; the DIG is built
+ * from the buffers by pf_merge_staged().
+ */
+
 int register_node_with_size(uintptr_t base, int64_t size, int64_t elem_size, int64_t node_id)
 {
 	int err = 0;
 
-	params->RegisterNodeWithSize(base, size, elem_size, node_id);
+	get_staging_buffer().nodes.push_back({base, size, elem_size, node_id});
 
 	return err;
 }
 
+/**
+ * @brief Registers one field of each element of the node containing
+ *        base as a node of its own, so that traversal edges into an
+ *        array of structs can index the field like a flat array.
+ *        Emitted by the prefetcher codegen before the traversal edge to
+ *        base + field_offset.
+ * @param base Base addr of the array of structs
+ * @param field_offset Offset of the field in each struct
+ * @param stride Size of each struct
+ * @param node_id Id of the field node
+ * @retval Int 0 on success
+ */
+int register_field_view(uintptr_t base, int64_t field_offset, int64_t stride,
+                        int64_t node_id)
+{
+	int err = 0;
+
+	// covered by the loaded snapshot
+	if (dig_snapshot) {
+		return err;
+	}
+
+	get_staging_buffer().field_views.push_back({base, field_offset, stride, node_id});
+
+	return err;
+}
 
 __attribute__ ((noinline))
 int
@@ -121,7 +1480,12 @@ register_trav_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f, in
 {
 	int err = 0;
 
-	(void) params->RegisterTravEdge(baseaddr_from, baseaddr_to, f, id);
+	// covered by the loaded snapshot
+	if (dig_snapshot) {
+		return err;
+	}
+
+	stage_trav_edge({baseaddr_from, baseaddr_to, NodeId(), NodeId(), f, f, id, false});
 
 	return err;
 }
@@ -131,7 +1495,12 @@ register_trav_edge2(NodeId id_from, NodeId id_to, FuncId f)
 {
 	int err = 0;
 
-	(void) params->RegisterTravEdge(id_from, id_to, f);
+	// covered by the loaded snapshot
+	if (dig_snapshot) {
+		return err;
+	}
+
+	stage_trav_edge({0, 0, id_from, id_to, f, f, 0, true});
 
 	return err;
 }
@@ -140,7 +1509,13 @@ int register_trig_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f
 {
 	int err = 0;
 
-	params->RegisterTrigEdge(baseaddr_from, baseaddr_to, f, sq_f);
+	// covered by the loaded snapshot
+	if (dig_snapshot) {
+		return err;
+	}
+
+	get_staging_buffer().trig_edges.push_back(
+			{baseaddr_from, baseaddr_to, NodeId(), NodeId(), f, sq_f, 0, false});
 
 	return err;
 }
@@ -149,21 +1524,266 @@ int register_trig_edge2(NodeId id_from, NodeId id_to, FuncId f, FuncId sq_f)
 {
 	int err = 0;
 
-	params->RegisterTrigEdge(id_from, id_to, f, sq_f);
+	// covered by the loaded snapshot
+	if (dig_snapshot) {
+		return err;
+	}
+
+	get_staging_buffer().trig_edges.push_back(
+			{0, 0, id_from, id_to, f, sq_f, 0, true});
+
+	return err;
+}
+
+/**
+ * @brief Registers a trigger edge on the elements [begin, end) of the node
+ *        at base, which the calling thread iterates over in a parallel
+ *        loop. When merged, the elements become the slice of the node in
+ *        the DIG view of the thread's core, replacing the slice the core
+ *        had, so that the prefetches of different cores do not run into
+ *        each other's part of the node. Emitted by the prefetcher codegen
+ *        once the bounds of a statically scheduled OpenMP loop are known.
+ * @param base Base addr of the trigger node
+ * @param begin First element iterated over by the thread
+ * @param end Element past the last one iterated over by the thread
+ * @param f Trigger function
+ * @param sq_f Squash function
+ * @retval Int 0 on success
+ */
+int register_trig_edge_range(uintptr_t base, int64_t begin, int64_t end, FuncId f,
+                             FuncId sq_f)
+{
+	int err = 0;
+
+	staging_buffer_t &buffer = get_staging_buffer();
+	staged_trig_range_t r = {base, begin, end, f, sq_f};
+
+	// parallel loops inside sequential loops repeat the same range
+	if (buffer.trig_ranges.empty() || !(buffer.trig_ranges.back() == r)) {
+		buffer.trig_ranges.push_back(r);
+	}
+
+	return err;
+}
+
+/*
+ * Edge profiling hooks, emitted by -prefetcher-codegen-mode=profile at the
+ * accesses of each candidate traversal edge. Every module registers the
+ * keys of its edges once, and its hooks pass the dense index of the edge,
+ * so the counters of each thread are a flat array. They are summed by
+ * pf_dump_edge_profile(), whose output is read back by
+ * -prefetcher-edge-profile to emit only the profitable edges.
+ */
+
+static void dump_edge_profile_at_exit()
+{
+	pf_dump_edge_profile();
+}
+
+static edge_profile_t &get_edge_profile(int64_t edge_index)
+{
+	std::vector<edge_profile_t> &counters = get_staging_buffer().edge_profile;
+
+	if ((uint64_t) edge_index >= counters.size()) {
+		counters.resize(std::max(num_profiled_edges.load(std::memory_order_acquire),
+					edge_index + 1));
+	}
+
+	return counters[edge_index];
+}
+
+/**
+ * @brief Registers the candidate traversal edges of a module, from a
+ *        module constructor emitted by the codegen. Edges that are never
+ *        exercised are listed in the profile too.
+ * @param keys Key of each edge, stable across compilations
+ * @param count Number of edges
+ * @param first_index Set to the index of the first edge; the hooks of
+ *        the module pass it plus the position of their edge in keys
+ * @retval Int 0 on success
+ */
+int register_identify_edge_table(const int64_t *keys, int64_t count, int64_t *first_index)
+{
+	int err = 0;
+
+	static std::once_flag dump_at_exit;
+	std::call_once(dump_at_exit, [] {
+		edge_profiling = true;
+		std::atexit(dump_edge_profile_at_exit);
+	});
+
+	std::lock_guard<std::mutex> lock(edge_keys_mutex);
+	std::vector<int64_t> &edge_keys = get_edge_keys();
+	*first_index = edge_keys.size();
+	edge_keys.insert(edge_keys.end(), keys, keys + count);
+	num_profiled_edges.store(edge_keys.size(), std::memory_order_release);
+
+	return err;
+}
+
+/**
+ * @brief Declares a single candidate traversal edge. The codegen declares
+ *        the edges of a module with register_identify_edge_table(), so
+ *        this only keeps binaries that call it linkable.
+ * @retval Int 0 on success
+ */
+int register_identify_edge(uintptr_t /* baseaddr_from */, uintptr_t /* baseaddr_to */,
+                           FuncId /* f */, int64_t /* edge_id */)
+{
+	int err = 0;
+
+	return err;
+}
+
+/**
+ * @brief Counts an execution of the source access of an edge.
+ * @param baseaddr_from Address read by the source access
+ * @param edge_index Index of the edge
+ * @retval Int 0 on success
+ */
+int register_identify_edge_source(uintptr_t /* baseaddr_from */, int64_t edge_index)
+{
+	int err = 0;
+
+	get_edge_profile(edge_index).exercised++;
 
 	return err;
 }
 
+/**
+ * @brief Counts an execution of the target access of an edge, and
+ *        whether it is likely to miss.
+ * @param baseaddr_to Address read by the target access
+ * @param edge_index Index of the edge
+ * @retval Int 0 on success
+ */
+int register_identify_edge_target(uintptr_t baseaddr_to, int64_t edge_index)
+{
+	int err = 0;
+
+	edge_profile_t &p = get_edge_profile(edge_index);
+	uintptr_t line = baseaddr_to >> cache_line_shift;
+
+	p.accesses++;
+	if (line != p.last_line && line != p.last_line + 1) {
+		p.misses++;
+	}
+	p.last_line = line;
+
+	return err;
+}
+
+/**
+ * @brief Writes the edge profile collected so far to PF_EDGE_PROFILE, or
+ *        to pf_edge_profile.txt, one line per edge:
+ *        <edge key in hex> <exercised> <accesses> <misses>
+ *        Called from sim_roi_end() and on exit.
+ *        NOTE: Profiled threads must have finished, as for pf_merge_staged()
+ * @retval Int 0 on success, -1 if the file could not be written
+ */
+int pf_dump_edge_profile()
+{
+	std::map<int64_t, edge_profile_t> profile;
+
+	std::lock_guard<std::mutex> lock(edge_keys_mutex);
+	const std::vector<int64_t> &edge_keys = get_edge_keys();
+	for (int64_t key : edge_keys) {
+		profile[key];
+	}
+
+	for (staging_buffer_t *b = staging_buffers.load(std::memory_order_acquire); b; b = b->next) {
+		size_t n = std::min(b->edge_profile.size(), edge_keys.size());
+		for (size_t i = 0; i < n; ++i) {
+			edge_profile_t &p = profile[edge_keys[i]];
+			p.exercised += b->edge_profile[i].exercised;
+			p.accesses += b->edge_profile[i].accesses;
+			p.misses += b->edge_profile[i].misses;
+		}
+	}
+
+	const char *path = std::getenv("PF_EDGE_PROFILE");
+	FILE *f = fopen(path ? path : "pf_edge_profile.txt", "w");
+	if (!f) {
+		return -1;
+	}
+
+	fprintf(f, "# edge exercised accesses misses\n");
+	for (auto &e : profile) {
+		fprintf(f, "%016" PRIx64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", (uint64_t) e.first,
+				e.second.exercised, e.second.accesses, e.second.misses);
+	}
+
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Hook emitted by -prefetcher-trigger-hooks before each access to a
+ *        trigger node. The simulated prefetcher observes the accesses
+ *        itself, so this only keeps hooked binaries linkable; the native
+ *        runtime prefetches from here.
+ * @param addr Address read by the access
+ * @retval Int 0 on success
+ */
+int pf_trigger_access(uintptr_t /* addr */)
+{
+	return 0;
+}
+
 int sim_user_pf_set_param()
 {
 	int err = 0;
 
+	pf_merge_staged();
+
+	// save the finished DIG for the next run
+	const char *snapshot_path = std::getenv("PF_DIG_SNAPSHOT");
+	if (snapshot_path && !dig_snapshot && pf_save_snapshot(snapshot_path) != 0) {
+		printf("pf: failed to save DIG snapshot %s\n", snapshot_path);
+	}
+
 	SimUser(PF_SET_PARAM, (long unsigned int) params);
 	printf("pf: &params = %p\n", params);
 
+	// the simulator holds the whole DIG now
+	dig_delta.clear();
+	dig_pushed = true;
+
 	return err;
 }
 
+/**
+ * @brief Pushes the changes made to the DIG since the last push, so that
+ *        updating the DIG between phases costs time proportional to the
+ *        change. Nothing is sent if the DIG has not changed. The first
+ *        push, and every push to a simulator whose pf_interface.h does
+ *        not define PF_UPDATE_PARAM, sends the whole DIG as
+ *        sim_user_pf_set_param() does.
+ * @retval Int 0 on success
+ */
+int sim_user_pf_update()
+{
+	int err = 0;
+
+	pf_merge_staged();
+
+	if (dig_pushed && dig_delta.empty()) {
+		return err;
+	}
+
+#ifdef PF_UPDATE_PARAM
+	if (dig_pushed) {
+		pf_dig_delta_t delta = {dig_delta.data(), (int64_t) dig_delta.size()};
+		SimUser(PF_UPDATE_PARAM, (long unsigned int) &delta);
+		printf("pf: pushed %zu DIG changes\n", dig_delta.size());
+
+		dig_delta.clear();
+		return err;
+	}
+#endif
+
+	return sim_user_pf_set_param();
+}
+
 int sim_user_pf_set_enable()
 {
 	int err = 0;
@@ -188,8 +1808,9 @@ int sim_user_pf_enable()
  * @brief Removes the traversal edge between the two defined
  *        nodes in the DIG
  *        NOTE: This only removes from the application representation
- *              and requires a sim_user_pf_set_param() call to
- *              push the changes to the simulator
+ *              and requires a sim_user_pf_update() or
+ *              sim_user_pf_set_param() call to push the changes to
+ *              the simulator
  * @param baseaddr_from Base addr of the from node
  * @param baseaddr_to Base addr of the to node
  * @retval Int 0 on success
@@ -197,21 +1818,33 @@ int sim_user_pf_enable()
 int
 pf_delete_trav(uintptr_t baseaddr_from, uintptr_t baseaddr_to)
 {
+	pf_merge_staged();
 	params->DeleteTravEdge(baseaddr_from, baseaddr_to);
+	delete_merged_edges(merged_dig.trav, baseaddr_from, baseaddr_to);
+	record_delta(PF_DIG_DELTA_DELETE_TRAV_EDGE, baseaddr_from, baseaddr_to);
 	return 0;
 }
 
 /**
  * @brief Removes the all traversal edges from DIG
  *        NOTE: This only removes from the application representation
- *              and requires a sim_user_pf_set_param() call to
- *              push the changes to the simulator
+ *              and requires a sim_user_pf_update() or
+ *              sim_user_pf_set_param() call to push the changes to
+ *              the simulator
  * @retval Int 0 on success
  */
 int
 pf_clear_trav()
 {
+	pf_merge_staged();
 	params->ClearTravEdges();
+	merged_dig.clear_edges(merged_dig.trav);
+	merged_trav_edge_keys.clear();
+	record_delta(PF_DIG_DELTA_CLEAR_TRAV_EDGES);
+	// slices copy the traversal edges when they are next registered
+	for (auto &view : core_views) {
+		view.clear();
+	}
 	return 0;
 }
 
@@ -219,8 +1852,9 @@ pf_clear_trav()
  * @brief Removes the trigger edge between the two defined
  *        nodes in the DIG
  *        NOTE: This only removes from the application representation
- *              and requires a sim_user_pf_set_param() call to
- *              push the changes to the simulator
+ *              and requires a sim_user_pf_update() or
+ *              sim_user_pf_set_param() call to push the changes to
+ *              the simulator
  * @param baseaddr_from Base addr of the from node
  * @param baseaddr_to Base addr of the to node
  * @retval Int 0 on success
@@ -228,21 +1862,31 @@ pf_clear_trav()
 int
 pf_delete_trig(uintptr_t baseaddr_from, uintptr_t baseaddr_to)
 {
+	pf_merge_staged();
 	params->DeleteTrigEdge(baseaddr_from, baseaddr_to);
+	delete_merged_edges(merged_dig.trig, baseaddr_from, baseaddr_to);
+	record_delta(PF_DIG_DELTA_DELETE_TRIG_EDGE, baseaddr_from, baseaddr_to);
 	return 0;
 }
 
 /**
  * @brief Removes the all trigger edges from DIG
  *        NOTE: This only removes from the application representation
- *              and requires a sim_user_pf_set_param() call to
- *              push the changes to the simulator
+ *              and requires a sim_user_pf_update() or
+ *              sim_user_pf_set_param() call to push the changes to
+ *              the simulator
  * @retval Int 0 on success
  */
 int
 pf_clear_trig()
 {
+	pf_merge_staged();
 	params->ClearTrigEdges();
+	merged_dig.clear_edges(merged_dig.trig);
+	record_delta(PF_DIG_DELTA_CLEAR_TRIG_EDGES);
+	for (auto &view : core_views) {
+		view.clear();
+	}
 	return 0;
 }
 
@@ -261,6 +1905,13 @@ int sim_roi_start()
 {
 	SimRoiStart();
 
+	// sample loads on real hardware, where the prefetcher cannot report
+	if (const char *period = std::getenv("PF_SAMPLE_PERIOD")) {
+		if (!SimInSimulator() && !sampler && !start_sampling(std::strtoull(period, nullptr, 0))) {
+			printf("pf: sampling not available\n");
+		}
+	}
+
     printf("gapbs: bfs_enable_t @ %p\n", &enable); // don't ask why: absolutely need this print here
                                                  // to pass correct address
 
@@ -279,6 +1930,24 @@ int sim_roi_end()
 {
 	SimRoiEnd();
 	SimUser(PF_DISABLE,0);
+
+	if (edge_profiling) {
+		pf_dump_edge_profile();
+	}
+
+	if (sampler) {
+		stop_sampling(*sampler);
+		pf_merge_staged();
+
+		const char *path = std::getenv("PF_SAMPLE_REPORT");
+		if (FILE *f = fopen(path ? path : "pf_sample_report.txt", "w")) {
+			write_sampling_report(*sampler, f);
+			fclose(f);
+		}
+
+		delete sampler;
+		sampler = nullptr;
+	}
 	return 0;
 }
 
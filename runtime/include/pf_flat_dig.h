@@ -0,0 +1,353 @@
+/*
+BSD 3-Clause License
+
+Copyright (c) 2021, Kuba Kaszyk and Chris Vasiladiotis
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef INCLUDE_PF_FLAT_DIG_H_
+#define INCLUDE_PF_FLAT_DIG_H_
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * @brief DIG held by the runtimes, as flat arrays that any backend can
+ *        walk without chasing pointers.
+ *
+ * Nodes are a struct of arrays sorted by base address, and edges are
+ * grouped by source node in a CSR layout, so that finding the node of an
+ * address is a binary search over one array and the edges of a node are a
+ * contiguous range. Additions only append; the sorted order and the CSR
+ * offsets are rebuilt by index(), which the lookups call when needed, so a
+ * batch of registrations is indexed once.
+ */
+class pf_flat_dig_t {
+public:
+	enum : uint32_t { npos = UINT32_MAX };
+
+	/**
+	 * @brief Edges of one kind. from and to are base addresses, or node
+	 *        ids for edges registered by node id. arg is the id of a
+	 *        traversal edge and the squash function of a trigger edge.
+	 *        Once indexed, the edges of node n are [offsets[n],
+	 *        offsets[n + 1]), followed by the edges whose source is not a
+	 *        node.
+	 */
+	struct edges_t {
+		std::vector<uint64_t> from;
+		std::vector<uint64_t> to;
+		std::vector<int64_t> f;
+		std::vector<int64_t> arg;
+		std::vector<uint8_t> by_node_id;
+		// resolved node indices, npos if not a node
+		std::vector<uint32_t> src;
+		std::vector<uint32_t> dst;
+		std::vector<uint32_t> offsets;
+
+		size_t size() const { return from.size(); }
+	};
+
+	// nodes, sorted by base once indexed
+	std::vector<uintptr_t> node_base;
+	std::vector<int64_t> node_size;
+	std::vector<int64_t> node_elem_size;
+	std::vector<int64_t> node_id;
+
+	edges_t trav;
+	edges_t trig;
+
+	size_t num_nodes() const { return node_base.size(); }
+
+	/**
+	 * @brief Adds a node. A later node with the same base replaces it, and
+	 *        a later node with the same id takes over the id.
+	 */
+	void add_node(uintptr_t base, int64_t size, int64_t elem_size, int64_t id)
+	{
+		node_base.push_back(base);
+		node_size.push_back(size);
+		node_elem_size.push_back(elem_size);
+		node_id.push_back(id);
+		node_seq.push_back(next_seq++);
+		indexed = false;
+	}
+
+	void add_edge(edges_t &edges, uint64_t from, uint64_t to, int64_t f, int64_t arg,
+			bool by_node_id)
+	{
+		edges.from.push_back(from);
+		edges.to.push_back(to);
+		edges.f.push_back(f);
+		edges.arg.push_back(arg);
+		edges.by_node_id.push_back(by_node_id);
+		edges.src.push_back(npos);
+		edges.dst.push_back(npos);
+		indexed = false;
+	}
+
+	/**
+	 * @brief Removes the edges for which pred(edges, i) holds.
+	 */
+	template <typename Pred>
+	void remove_edges(edges_t &edges, Pred pred)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < edges.size(); ++i) {
+			if (pred(edges, i)) {
+				continue;
+			}
+			move_edge(edges, i, kept++);
+		}
+		resize_edges(edges, kept);
+		indexed = false;
+	}
+
+	void clear_edges(edges_t &edges)
+	{
+		resize_edges(edges, 0);
+		indexed = false;
+	}
+
+	void clear()
+	{
+		node_base.clear();
+		node_size.clear();
+		node_elem_size.clear();
+		node_id.clear();
+		node_seq.clear();
+		clear_edges(trav);
+		clear_edges(trig);
+	}
+
+	/**
+	 * @brief Sorts the nodes by base, dropping replaced ones, and groups
+	 *        the edges by source node.
+	 */
+	void index()
+	{
+		if (indexed) {
+			return;
+		}
+
+		std::vector<uint32_t> order(num_nodes());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return node_base[a] != node_base[b] ? node_base[a] < node_base[b] :
+				node_seq[a] < node_seq[b];
+		});
+
+		// the last registration of each base wins
+		std::vector<uint32_t> kept;
+		kept.reserve(order.size());
+		for (size_t i = 0; i < order.size(); ++i) {
+			if (i + 1 < order.size() && node_base[order[i + 1]] == node_base[order[i]]) {
+				continue;
+			}
+			kept.push_back(order[i]);
+		}
+
+		permute(node_base, kept);
+		permute(node_size, kept);
+		permute(node_elem_size, kept);
+		permute(node_id, kept);
+		permute(node_seq, kept);
+
+		max_end.resize(num_nodes());
+		for (size_t i = 0; i < num_nodes(); ++i) {
+			uintptr_t end = get_end(i);
+			max_end[i] = i ? std::max(max_end[i - 1], end) : end;
+		}
+
+		by_id.resize(num_nodes());
+		std::iota(by_id.begin(), by_id.end(), 0);
+		std::sort(by_id.begin(), by_id.end(), [&](uint32_t a, uint32_t b) {
+			return node_id[a] != node_id[b] ? node_id[a] < node_id[b] :
+				node_seq[a] < node_seq[b];
+		});
+
+		indexed = true;
+
+		index_edges(trav);
+		index_edges(trig);
+	}
+
+	/**
+	 * @brief Node containing addr, the innermost one for nested nodes.
+	 *        Empty nodes contain their base.
+	 */
+	uint32_t find_node(uintptr_t addr)
+	{
+		index();
+
+		size_t i = std::upper_bound(node_base.begin(), node_base.end(), addr) -
+			node_base.begin();
+
+		// only nested nodes need more than one step
+		while (i-- > 0 && max_end[i] > addr) {
+			if (addr < get_end(i)) {
+				return i;
+			}
+		}
+		return npos;
+	}
+
+	uint32_t find_node_base(uintptr_t base)
+	{
+		index();
+
+		auto it = std::lower_bound(node_base.begin(), node_base.end(), base);
+		return it != node_base.end() && *it == base ? it - node_base.begin() : (uint32_t) npos;
+	}
+
+	/**
+	 * @brief Last node registered with id.
+	 */
+	uint32_t find_node_id(int64_t id)
+	{
+		index();
+
+		auto it = std::upper_bound(by_id.begin(), by_id.end(), id,
+				[&](int64_t v, uint32_t n) { return v < node_id[n]; });
+		return it != by_id.begin() && node_id[*(it - 1)] == id ? *(it - 1) : (uint32_t) npos;
+	}
+
+	/**
+	 * @brief Range of the edges of node n, or of the edges whose source is
+	 *        not a node for npos.
+	 */
+	std::pair<uint32_t, uint32_t> get_edges(edges_t &edges, uint32_t n)
+	{
+		index();
+
+		if (n == npos) {
+			return {edges.offsets[num_nodes()], (uint32_t) edges.size()};
+		}
+		return {edges.offsets[n], edges.offsets[n + 1]};
+	}
+
+private:
+	// registration order, to tell which of two nodes is the later one
+	std::vector<uint64_t> node_seq;
+	uint64_t next_seq = 0;
+	// largest end of the nodes up to each index
+	std::vector<uintptr_t> max_end;
+	// node indices sorted by id
+	std::vector<uint32_t> by_id;
+	bool indexed = false;
+
+	uintptr_t get_end(size_t i) const
+	{
+		return node_base[i] + std::max<int64_t>(node_size[i], 1);
+	}
+
+	template <typename T>
+	static void permute(std::vector<T> &v, const std::vector<uint32_t> &order)
+	{
+		std::vector<T> out;
+		out.reserve(order.size());
+		for (uint32_t i : order) {
+			out.push_back(v[i]);
+		}
+		v.swap(out);
+	}
+
+	static void move_edge(edges_t &edges, size_t from, size_t to)
+	{
+		edges.from[to] = edges.from[from];
+		edges.to[to] = edges.to[from];
+		edges.f[to] = edges.f[from];
+		edges.arg[to] = edges.arg[from];
+		edges.by_node_id[to] = edges.by_node_id[from];
+		edges.src[to] = edges.src[from];
+		edges.dst[to] = edges.dst[from];
+	}
+
+	static void resize_edges(edges_t &edges, size_t size)
+	{
+		edges.from.resize(size);
+		edges.to.resize(size);
+		edges.f.resize(size);
+		edges.arg.resize(size);
+		edges.by_node_id.resize(size);
+		edges.src.resize(size);
+		edges.dst.resize(size);
+	}
+
+	uint32_t resolve(uint64_t v, bool by_node_id)
+	{
+		return by_node_id ? find_node_id(v) : find_node_base(v);
+	}
+
+	/**
+	 * @brief Resolves the endpoints of the edges and sorts them into CSR
+	 *        order, keeping the registration order within each node.
+	 */
+	void index_edges(edges_t &edges)
+	{
+		for (size_t i = 0; i < edges.size(); ++i) {
+			edges.src[i] = resolve(edges.from[i], edges.by_node_id[i]);
+			edges.dst[i] = resolve(edges.to[i], edges.by_node_id[i]);
+		}
+
+		// counting sort, with the edges of no node in the last bucket
+		size_t buckets = num_nodes() + 1;
+		auto bucket = [&](size_t i) {
+			return edges.src[i] == npos ? num_nodes() : edges.src[i];
+		};
+
+		std::vector<uint32_t> offsets(buckets + 1, 0);
+		for (size_t i = 0; i < edges.size(); ++i) {
+			offsets[bucket(i) + 1]++;
+		}
+		for (size_t b = 0; b < buckets; ++b) {
+			offsets[b + 1] += offsets[b];
+		}
+
+		std::vector<uint32_t> order(edges.size());
+		std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < edges.size(); ++i) {
+			order[next[bucket(i)]++] = i;
+		}
+
+		permute(edges.from, order);
+		permute(edges.to, order);
+		permute(edges.f, order);
+		permute(edges.arg, order);
+		permute(edges.by_node_id, order);
+		permute(edges.src, order);
+		permute(edges.dst, order);
+
+		offsets.pop_back();
+		edges.offsets.swap(offsets);
+	}
+};
+
+#endif /* INCLUDE_PF_FLAT_DIG_H_ */
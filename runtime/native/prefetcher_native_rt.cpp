@@ -0,0 +1,848 @@
+/*
+BSD 3-Clause License
+
+Copyright (c) 2021, Kuba Kaszyk and Chris Vasiladiotis
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its
+   contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Native runtime: implements the DIG in software, behind the same C
+ * interface as the default (simulator) runtime, so that a binary
+ * instrumented by the prefetcher codegen runs on commodity hardware by
+ * linking against this library instead.
+ *
+ * The DIG is registered as usual, and compiled into a prefetch plan when
+ * it is pushed with sim_user_pf_set_param() or enabled with
+ * sim_roi_start(). The prefetches are issued by pf_trigger_access(), the
+ * hook that -prefetcher-trigger-hooks emits before every access to a
+ * trigger node: it looks ahead in the trigger node and walks the
+ * traversal edges from there, reading the indices that earlier hooks
+ * have already brought into the cache and prefetching the next level.
+ * In parallel loops the lookahead stops at the end of the elements of
+ * the calling thread, as registered by register_trig_edge_range().
+ */
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cinttypes>
+#include <pf_flat_dig.h>
+
+/*
+ * Declared by pf_interface.h in the default runtime, which is only
+ * available with the simulator. Must be kept in sync with FuncId in the
+ * prefetcher codegen.
+ */
+typedef int64_t NodeId;
+
+enum FuncId {
+	// traversal functions registered
+	TraversalHolder,
+	BaseOffset_int32_t,
+	PointerBounds_int32_t,
+	PointerBounds_uint64_t,
+
+	// trigger functions registered
+	TriggerHolder,
+	UpToOffset,
+	StaticOffset_32,
+	StaticOffset_64,
+	StaticOffset_256,
+	StaticOffset_512,
+	StaticOffset_1024,
+
+	// squash functions registered
+	SquashIfLarger,
+	NeverSquash
+};
+
+/**
+ * @brief Kind of an entry of a DIG table passed to register_dig_batch().
+ *        Must be kept in sync with DIGDescKind in the prefetcher codegen.
+ */
+enum pf_dig_desc_kind_t {
+	PF_DIG_DESC_NODE = 1,
+	PF_DIG_DESC_TRAV_EDGE,
+	PF_DIG_DESC_TRIG_EDGE,
+	PF_DIG_DESC_FIELD_VIEW
+};
+
+/**
+ * @brief Entry of a DIG table, as in the default runtime.
+ */
+struct pf_dig_desc_t {
+	int64_t kind;
+	uint64_t arg0;
+	uint64_t arg1;
+	int64_t arg2;
+	int64_t arg3;
+};
+
+namespace {
+
+// longest chain of traversal edges followed from a trigger node
+constexpr unsigned max_chain_depth = 4;
+// cache lines prefetched for the range of a PointerBounds edge
+constexpr int64_t max_range_lines = 8;
+constexpr int64_t cache_line_size = 64;
+// lookahead of an UpToOffset trigger edge, in elements
+constexpr int64_t default_distance = 16;
+// trigger nodes a thread keeps the bounds of its elements for
+constexpr size_t max_thread_ranges = 8;
+
+struct native_field_view_t {
+	uintptr_t base;
+	int64_t field_offset;
+	int64_t stride;
+	int64_t node_id;
+};
+
+struct dig_table_t {
+	pf_dig_desc_t *descs;
+	int64_t count;
+};
+
+/**
+ * @brief One traversal edge of a chain, resolved to the bounds of its
+ *        nodes.
+ */
+struct hop_t {
+	uintptr_t src_end;
+	int64_t src_elem_size;
+	uintptr_t dst_base;
+	uintptr_t dst_end;
+	int64_t dst_elem_size;
+	int64_t dst_count;
+	FuncId f;
+};
+
+struct chain_t {
+	std::vector<hop_t> hops;
+	// lookahead between two levels, in bytes of the trigger node
+	int64_t step;
+};
+
+struct trigger_t {
+	uintptr_t base;
+	uintptr_t end;
+	int64_t elem_size;
+	int64_t distance;
+	std::vector<chain_t> chains;
+};
+
+/**
+ * @brief Immutable prefetch plan, read by the hooks without locking.
+ *        Triggers are sorted by base address.
+ */
+struct plan_t {
+	std::vector<trigger_t> triggers;
+
+	const trigger_t *find_trigger(uintptr_t addr) const
+	{
+		auto it = std::upper_bound(triggers.begin(), triggers.end(), addr,
+				[](uintptr_t a, const trigger_t &t) { return a < t.base; });
+		if (it == triggers.begin()) {
+			return nullptr;
+		}
+		--it;
+		return addr < it->end ? &*it : nullptr;
+	}
+};
+
+// registered DIG, guarded by dig_mutex
+std::mutex dig_mutex;
+pf_flat_dig_t dig;
+std::vector<native_field_view_t> field_views;
+std::vector<dig_table_t> dig_tables;
+bool dig_changed = true;
+
+// plans are kept until delete_params(), since hooks may still read a
+// replaced one
+std::vector<std::unique_ptr<plan_t>> plans;
+const plan_t *current_plan = nullptr;
+std::atomic<const plan_t *> active_plan{nullptr};
+bool prefetch_enabled = false;
+
+/**
+ * @brief Elements [begin, end) of the trigger node at base that the
+ *        calling thread iterates over in a parallel loop.
+ */
+struct thread_range_t {
+	uintptr_t base;
+	int64_t begin;
+	int64_t end;
+};
+
+thread_local thread_range_t thread_ranges[max_thread_ranges]
+	__attribute__ ((tls_model("initial-exec")));
+thread_local size_t num_thread_ranges
+	__attribute__ ((tls_model("initial-exec"))) = 0;
+
+/**
+ * @brief Trigger of the last hooked access, with the addresses it may
+ *        look ahead within. Accesses of a loop mostly hit the same one.
+ */
+struct hook_cache_t {
+	const plan_t *plan;
+	const trigger_t *trigger;
+	uintptr_t begin;
+	uintptr_t end;
+};
+
+thread_local hook_cache_t hook_cache
+	__attribute__ ((tls_model("initial-exec"))) = {nullptr, nullptr, 0, 0};
+
+int64_t get_distance(FuncId f)
+{
+	if (const char *distance = std::getenv("PF_NATIVE_DISTANCE")) {
+		return std::max<int64_t>(1, std::strtoll(distance, nullptr, 0));
+	}
+
+	switch (f) {
+	case StaticOffset_32:
+		return 32;
+	case StaticOffset_64:
+		return 64;
+	case StaticOffset_256:
+		return 256;
+	case StaticOffset_512:
+		return 512;
+	case StaticOffset_1024:
+		return 1024;
+	default:
+		return default_distance;
+	}
+}
+
+bool is_traversal(FuncId f)
+{
+	return f == BaseOffset_int32_t || f == PointerBounds_int32_t ||
+		f == PointerBounds_uint64_t;
+}
+
+bool is_ranged(FuncId f)
+{
+	return f == PointerBounds_int32_t || f == PointerBounds_uint64_t;
+}
+
+/**
+ * @brief Collects the nodes, views and edges registered so far, including
+ *        the reached entries of the DIG tables. Called with dig_mutex held.
+ */
+pf_flat_dig_t collect_dig()
+{
+	pf_flat_dig_t all = dig;
+	std::vector<native_field_view_t> all_views = field_views;
+
+	for (const dig_table_t &table : dig_tables) {
+		for (int64_t i = 0; i < table.count; ++i) {
+			const pf_dig_desc_t &d = table.descs[i];
+			if (!d.arg0) {
+				continue;
+			}
+
+			switch (d.kind) {
+			case PF_DIG_DESC_NODE:
+				all.add_node(d.arg0, d.arg1, d.arg2, d.arg3);
+				break;
+			case PF_DIG_DESC_TRAV_EDGE:
+				all.add_edge(all.trav, d.arg0, d.arg1, d.arg2, d.arg3, false);
+				break;
+			case PF_DIG_DESC_TRIG_EDGE:
+				all.add_edge(all.trig, d.arg0, d.arg1, d.arg2, d.arg3, false);
+				break;
+			case PF_DIG_DESC_FIELD_VIEW:
+				all_views.push_back({d.arg0, (int64_t) d.arg1, d.arg2, d.arg3});
+				break;
+			}
+		}
+	}
+
+	// a view is a node of its own, over the rest of the containing node
+	for (const native_field_view_t &v : all_views) {
+		uint32_t n = all.find_node(v.base);
+		if (n == pf_flat_dig_t::npos) {
+			continue;
+		}
+
+		uintptr_t end = all.node_base[n] + all.node_size[n];
+		uintptr_t view_base = v.base + v.field_offset;
+		if (view_base < end) {
+			all.add_node(view_base, end - view_base, v.stride, v.node_id);
+		}
+	}
+
+	all.index();
+	return all;
+}
+
+/**
+ * @brief Compiles the registered DIG into a plan: every trigger node with
+ *        the chains of traversal edges that start at it.
+ *        Called with dig_mutex held.
+ */
+const plan_t *build_plan()
+{
+	pf_flat_dig_t all = collect_dig();
+
+	auto is_node = [&](uint32_t n) {
+		return n != pf_flat_dig_t::npos && all.node_elem_size[n] > 0;
+	};
+
+	auto make_hop = [&](uint32_t from, uint32_t to, FuncId f) {
+		return hop_t{all.node_base[from] + all.node_size[from], all.node_elem_size[from],
+			all.node_base[to], all.node_base[to] + all.node_size[to], all.node_elem_size[to],
+			all.node_size[to] / all.node_elem_size[to], f};
+	};
+
+	plan_t *plan = new plan_t();
+
+	// nodes are sorted by base, and so are the triggers
+	for (uint32_t node = 0; node < all.num_nodes(); ++node) {
+		auto trig = all.get_edges(all.trig, node);
+		if (trig.first == trig.second || !is_node(node)) {
+			continue;
+		}
+
+		trigger_t t;
+		t.base = all.node_base[node];
+		t.end = t.base + all.node_size[node];
+		t.elem_size = all.node_elem_size[node];
+		t.distance = 1;
+		for (uint32_t e = trig.first; e < trig.second; ++e) {
+			t.distance = std::max(t.distance, get_distance((FuncId) all.trig.f[e]));
+		}
+
+		// every maximal path from the trigger node, without cycles
+		std::vector<hop_t> path;
+		std::vector<uint32_t> visited = {node};
+		auto walk = [&](uint32_t cur, auto &self) -> void {
+			bool extended = false;
+			auto trav = all.get_edges(all.trav, cur);
+			for (uint32_t e = trav.first; path.size() < max_chain_depth && e < trav.second; ++e) {
+				uint32_t to = all.trav.dst[e];
+				FuncId f = (FuncId) all.trav.f[e];
+				if (!is_traversal(f) || !is_node(to) ||
+						std::find(visited.begin(), visited.end(), to) != visited.end()) {
+					continue;
+				}
+
+				// the same edge registered more than once
+				bool repeated = false;
+				for (uint32_t prev = trav.first; prev < e && !repeated; ++prev) {
+					repeated = all.trav.dst[prev] == to && all.trav.f[prev] == f;
+				}
+				if (repeated) {
+					continue;
+				}
+
+				path.push_back(make_hop(cur, to, f));
+				visited.push_back(to);
+				self(to, self);
+				visited.pop_back();
+				path.pop_back();
+				extended = true;
+			}
+			if (!extended && !path.empty()) {
+				t.chains.push_back({path, 0});
+			}
+		};
+		walk(node, walk);
+
+		for (chain_t &c : t.chains) {
+			c.step = std::max<int64_t>(1, t.distance / c.hops.size()) * t.elem_size;
+		}
+		if (!t.chains.empty()) {
+			plan->triggers.push_back(std::move(t));
+		}
+	}
+
+	plans.emplace_back(plan);
+	return plan;
+}
+
+/**
+ * @brief Rebuilds the plan if the DIG changed, and publishes it to the
+ *        hooks while prefetching is enabled.
+ */
+void update_plan(bool rebuild)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+
+	if (rebuild && dig_changed) {
+		current_plan = build_plan();
+		dig_changed = false;
+	}
+
+	active_plan.store(prefetch_enabled ? current_plan : nullptr,
+			std::memory_order_release);
+}
+
+void set_enabled(bool enabled)
+{
+	{
+		std::lock_guard<std::mutex> lock(dig_mutex);
+		prefetch_enabled = enabled;
+	}
+	update_plan(enabled);
+}
+
+/**
+ * @brief Reads the index stored at addr by a traversal function.
+ */
+inline int64_t read_index(uintptr_t addr, FuncId f)
+{
+	if (f == PointerBounds_uint64_t) {
+		return (int64_t) *reinterpret_cast<const volatile uint64_t *>(addr);
+	}
+	return *reinterpret_cast<const volatile int32_t *>(addr);
+}
+
+/**
+ * @brief Follows a hop from the source element at addr. Returns the
+ *        address of the target element, or 0 if it is out of bounds.
+ *        The last hop of a walk prefetches the target instead, the whole
+ *        range for PointerBounds edges.
+ */
+inline uintptr_t follow_hop(const hop_t &h, uintptr_t addr, bool last)
+{
+	int64_t lo = read_index(addr, h.f);
+	if (lo < 0 || lo >= h.dst_count) {
+		return 0;
+	}
+
+	uintptr_t target = h.dst_base + lo * h.dst_elem_size;
+	if (!last) {
+		return target;
+	}
+
+	uintptr_t end = target + h.dst_elem_size;
+	if (is_ranged(h.f) && addr + 2 * h.src_elem_size <= h.src_end) {
+		int64_t hi = std::min(read_index(addr + h.src_elem_size, h.f), h.dst_count);
+		if (hi > lo) {
+			end = h.dst_base + hi * h.dst_elem_size;
+		}
+	}
+	end = std::min(end, target + max_range_lines * cache_line_size);
+
+	for (uintptr_t line = target & ~(uintptr_t) (cache_line_size - 1); line < end;
+			line += cache_line_size) {
+		__builtin_prefetch(reinterpret_cast<const void *>(line), 0, 3);
+	}
+
+	return target;
+}
+
+} // namespace
+
+extern "C" {
+
+int create_params(int num_nodes_pf, int num_edges_pf, int num_triggers_pf);
+int create_enable();
+int register_node_with_size(uintptr_t base, int64_t size, int64_t elem_size,
+                            int64_t node_id);
+int register_trav_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to,
+                       FuncId f, int id);
+int register_trav_edge2(NodeId id_from, NodeId id_to, FuncId f);
+int register_trig_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f,
+                       FuncId sq_f);
+int register_trig_edge2(NodeId id_from, NodeId id_to, FuncId f, FuncId sq_f);
+int register_trig_edge_range(uintptr_t base, int64_t begin, int64_t end, FuncId f,
+                             FuncId sq_f);
+int register_dig_batch(pf_dig_desc_t *descs, int64_t count);
+int register_field_view(uintptr_t base, int64_t field_offset, int64_t stride,
+                        int64_t node_id);
+int pf_merge_staged();
+int pf_trigger_access(uintptr_t addr);
+int sim_user_pf_set_param();
+int sim_user_pf_update();
+int sim_user_pf_set_enable();
+int sim_user_pf_enable();
+int sim_user_wait();
+int sim_roi_start();
+int sim_roi_end();
+int sim_user_pf_disable();
+int pf_delete_trav(uintptr_t baseaddr_from, uintptr_t baseaddr_to);
+int pf_clear_trav();
+int pf_delete_trig(uintptr_t baseaddr_from, uintptr_t baseaddr_to);
+int pf_clear_trig();
+int print_params();
+int delete_params();
+int delete_enable();
+
+int create_params(int num_nodes_pf, int num_edges_pf, int num_triggers_pf)
+{
+	int params_id = 0;
+
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.node_base.reserve(num_nodes_pf);
+	dig.trav.from.reserve(num_edges_pf);
+	dig.trig.from.reserve(num_triggers_pf);
+
+	return params_id;
+}
+
+int create_enable()
+{
+	int enable_id = 0;
+	return enable_id;
+}
+
+int print_params()
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+
+	printf("pf: native DIG: %zu nodes, %zu views, %zu traversal edges, %zu trigger edges\n",
+			dig.num_nodes(), field_views.size(), dig.trav.size(), dig.trig.size());
+	if (current_plan) {
+		for (const trigger_t &t : current_plan->triggers) {
+			printf("pf: trigger [%#" PRIxPTR ", %#" PRIxPTR ") distance %" PRId64
+					", %zu chains\n", t.base, t.end, t.distance, t.chains.size());
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Registers a table of DIG nodes and edges, which is read when the
+ *        plan is built. See the default runtime.
+ * @param descs Table entries
+ * @param count Number of entries
+ * @retval Int 0 on success
+ */
+int register_dig_batch(pf_dig_desc_t *descs, int64_t count)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig_tables.push_back({descs, count});
+	dig_changed = true;
+	return 0;
+}
+
+/*
+ * The register_* functions below may be called concurrently. Registration
+ * is hoisted out of loops by the codegen, so a lock is cheap enough here.
+ */
+
+int register_node_with_size(uintptr_t base, int64_t size, int64_t elem_size, int64_t node_id)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.add_node(base, size, elem_size, node_id);
+	dig_changed = true;
+	return 0;
+}
+
+int register_field_view(uintptr_t base, int64_t field_offset, int64_t stride,
+                        int64_t node_id)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	field_views.push_back({base, field_offset, stride, node_id});
+	dig_changed = true;
+	return 0;
+}
+
+int
+register_trav_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f, int id)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.add_edge(dig.trav, baseaddr_from, baseaddr_to, f, id, false);
+	dig_changed = true;
+	return 0;
+}
+
+int
+register_trav_edge2(NodeId id_from, NodeId id_to, FuncId f)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.add_edge(dig.trav, id_from, id_to, f, 0, true);
+	dig_changed = true;
+	return 0;
+}
+
+int register_trig_edge1(uintptr_t baseaddr_from, uintptr_t baseaddr_to, FuncId f, FuncId sq_f)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.add_edge(dig.trig, baseaddr_from, baseaddr_to, f, sq_f, false);
+	dig_changed = true;
+	return 0;
+}
+
+int register_trig_edge2(NodeId id_from, NodeId id_to, FuncId f, FuncId sq_f)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.add_edge(dig.trig, id_from, id_to, f, sq_f, true);
+	dig_changed = true;
+	return 0;
+}
+
+/**
+ * @brief Bounds the lookahead of the calling thread in the trigger node at
+ *        base to the elements [begin, end), which it iterates over in a
+ *        parallel loop. The node is made a trigger node if it is not one
+ *        yet; the bounds only affect the calling thread.
+ * @param base Base addr of the trigger node
+ * @param begin First element iterated over by the thread
+ * @param end Element past the last one iterated over by the thread
+ * @param f Trigger function
+ * @param sq_f Squash function
+ * @retval Int 0 on success
+ */
+int register_trig_edge_range(uintptr_t base, int64_t begin, int64_t end, FuncId f,
+                             FuncId sq_f)
+{
+	size_t i = 0;
+	while (i < num_thread_ranges && thread_ranges[i].base != base) {
+		++i;
+	}
+
+	// the oldest range makes way once all slots are taken
+	if (i == max_thread_ranges) {
+		std::copy(thread_ranges + 1, thread_ranges + max_thread_ranges, thread_ranges);
+		i = max_thread_ranges - 1;
+	}
+	num_thread_ranges = std::max(num_thread_ranges, i + 1);
+
+	thread_ranges[i] = {base, begin, end};
+	hook_cache.trigger = nullptr;
+
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	for (size_t e = 0; e < dig.trig.size(); ++e) {
+		if (!dig.trig.by_node_id[e] && dig.trig.from[e] == base) {
+			return 0;
+		}
+	}
+	dig.add_edge(dig.trig, base, base, f, sq_f, false);
+	dig_changed = true;
+
+	return 0;
+}
+
+/**
+ * @brief Registrations are not staged by this runtime.
+ * @retval Int 0 on success
+ */
+int
+pf_merge_staged()
+{
+	return 0;
+}
+
+/**
+ * @brief Prefetches ahead of an access to a trigger node. For every chain
+ *        of k traversal edges from the node, the i-th level is prefetched
+ *        (k - i + 1) steps ahead of addr, reading the indices of the
+ *        levels before it, which the hooks of earlier accesses have
+ *        prefetched already. The lookahead stays within the elements of
+ *        the calling thread, if it registered a range of the node.
+ *        Emitted by -prefetcher-trigger-hooks before each access to a
+ *        trigger node.
+ * @param addr Address read by the access
+ * @retval Int 0 on success
+ */
+int pf_trigger_access(uintptr_t addr)
+{
+	const plan_t *plan = active_plan.load(std::memory_order_acquire);
+	if (!plan) {
+		return 0;
+	}
+
+	hook_cache_t &cache = hook_cache;
+	if (cache.plan != plan || !cache.trigger || addr < cache.begin || addr >= cache.end) {
+		const trigger_t *found = plan->find_trigger(addr);
+		cache = {plan, found, 0, 0};
+		if (!found) {
+			return 0;
+		}
+
+		cache.begin = found->base;
+		cache.end = found->end;
+		for (size_t i = 0; i < num_thread_ranges; ++i) {
+			const thread_range_t &r = thread_ranges[i];
+			uintptr_t begin = found->base + r.begin * found->elem_size;
+			uintptr_t end = found->base + r.end * found->elem_size;
+			if (r.base == found->base && addr >= begin && addr < end) {
+				cache.begin = begin;
+				cache.end = std::min(end, found->end);
+				break;
+			}
+		}
+	}
+
+	const trigger_t *t = cache.trigger;
+
+	for (const chain_t &chain : t->chains) {
+		size_t depth = chain.hops.size();
+
+		for (size_t level = 1; level <= depth; ++level) {
+			uintptr_t cur = addr + (depth - level + 1) * chain.step;
+			if (cur + t->elem_size > cache.end) {
+				continue;
+			}
+
+			for (size_t h = 0; h < level && cur; ++h) {
+				cur = follow_hop(chain.hops[h], cur, h + 1 == level);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int sim_user_pf_set_param()
+{
+	update_plan(true);
+	return 0;
+}
+
+/**
+ * @brief The plan is only rebuilt if the DIG changed, so an update is a
+ *        full push.
+ * @retval Int 0 on success
+ */
+int sim_user_pf_update()
+{
+	return sim_user_pf_set_param();
+}
+
+int sim_user_pf_set_enable()
+{
+	return 0;
+}
+
+int sim_user_pf_enable()
+{
+	set_enabled(true);
+	return 0;
+}
+
+int sim_user_wait()
+{
+	return 0;
+}
+
+int sim_roi_start()
+{
+	set_enabled(true);
+	return 0;
+}
+
+int sim_roi_end()
+{
+	set_enabled(false);
+	return 0;
+}
+
+int sim_user_pf_disable()
+{
+	set_enabled(false);
+	return 0;
+}
+
+/**
+ * @brief Removes the traversal edges between the two defined nodes
+ *        NOTE: Takes effect at the next sim_user_pf_set_param()
+ * @param baseaddr_from Base addr of the from node
+ * @param baseaddr_to Base addr of the to node
+ * @retval Int 0 on success
+ */
+int
+pf_delete_trav(uintptr_t baseaddr_from, uintptr_t baseaddr_to)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.remove_edges(dig.trav, [&](const pf_flat_dig_t::edges_t &e, size_t i) {
+		return !e.by_node_id[i] && e.from[i] == baseaddr_from && e.to[i] == baseaddr_to;
+	});
+	dig_changed = true;
+	return 0;
+}
+
+int
+pf_clear_trav()
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.clear_edges(dig.trav);
+	dig_changed = true;
+	return 0;
+}
+
+/**
+ * @brief Removes the trigger edges between the two defined nodes
+ *        NOTE: Takes effect at the next sim_user_pf_set_param()
+ * @param baseaddr_from Base addr of the from node
+ * @param baseaddr_to Base addr of the to node
+ * @retval Int 0 on success
+ */
+int
+pf_delete_trig(uintptr_t baseaddr_from, uintptr_t baseaddr_to)
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.remove_edges(dig.trig, [&](const pf_flat_dig_t::edges_t &e, size_t i) {
+		return !e.by_node_id[i] && e.from[i] == baseaddr_from && e.to[i] == baseaddr_to;
+	});
+	dig_changed = true;
+	return 0;
+}
+
+int
+pf_clear_trig()
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	dig.clear_edges(dig.trig);
+	dig_changed = true;
+	return 0;
+}
+
+/**
+ * @brief Frees the DIG and its plans.
+ *        NOTE: Prefetching must be disabled and no hook running
+ * @retval Int 0 on success
+ */
+int delete_params()
+{
+	std::lock_guard<std::mutex> lock(dig_mutex);
+	active_plan.store(nullptr, std::memory_order_release);
+	current_plan = nullptr;
+	plans.clear();
+	dig.clear();
+	field_views.clear();
+	dig_tables.clear();
+	dig_changed = true;
+	return 0;
+}
+
+int delete_enable()
+{
+	return 0;
+}
+
+} // extern "C"
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+
+"""Generates a synthetic LLVM IR module that exercises the prefetcher passes.
+
+Every function holds a number of loops. Each loop walks an index array and
+follows an indirection chain of the requested depth (A0[i] -> A1[A0[i]] ->
+...), and also compares two neighbouring entries of the first array, which
+is detected as a ranged indirection. main() allocates all arrays with
+operator new[] so that they become DIG nodes.
+"""
+
+import argparse
+import sys
+
+
+def gen_loop(out, l, depth, prev):
+    lp = 'l{}'.format(l)
+    out.append('{}:'.format(lp))
+    out.append('  %{0}.i = phi i64 [ 0, %{1} ], [ %{0}.inext, %{0} ]'.format(lp, prev))
+    out.append('  %{0}.acc = phi i32 [ 0, %{1} ], [ %{0}.accnext, %{0} ]'.format(lp, prev))
+    out.append('  %{0}.inext = add nuw nsw i64 %{0}.i, 1'.format(lp))
+
+    # ranged indirection on the first array
+    out.append('  %{0}.rb = getelementptr inbounds i32, i32* %a0, i64 %{0}.i'.format(lp))
+    out.append('  %{0}.re = getelementptr inbounds i32, i32* %a0, i64 %{0}.inext'.format(lp))
+    out.append('  %{0}.rbv = load i32, i32* %{0}.rb, align 4'.format(lp))
+    out.append('  %{0}.rev = load i32, i32* %{0}.re, align 4'.format(lp))
+    out.append('  %{0}.rc = icmp slt i32 %{0}.rbv, %{0}.rev'.format(lp))
+
+    # single-valued indirection chain
+    idx = '%{}.i'.format(lp)
+    for d in range(depth):
+        out.append('  %{0}.g{1} = getelementptr inbounds i32, i32* %a{1}, i64 {2}'.format(lp, d, idx))
+        out.append('  %{0}.v{1} = load i32, i32* %{0}.g{1}, align 4'.format(lp, d))
+        out.append('  %{0}.x{1} = sext i32 %{0}.v{1} to i64'.format(lp, d))
+        idx = '%{}.x{}'.format(lp, d)
+
+    out.append('  %{0}.gl = getelementptr inbounds i32, i32* %a{1}, i64 {2}'.format(lp, depth, idx))
+    out.append('  %{0}.vl = load i32, i32* %{0}.gl, align 4'.format(lp))
+    out.append('  %{0}.sel = select i1 %{0}.rc, i32 %{0}.vl, i32 0'.format(lp))
+    out.append('  %{0}.accnext = add i32 %{0}.acc, %{0}.sel'.format(lp))
+    out.append('  %{0}.c = icmp slt i64 %{0}.inext, %n'.format(lp))
+    out.append('  br i1 %{0}.c, label %{0}, label %{0}.exit'.format(lp))
+    out.append('{}.exit:'.format(lp))
+    out.append('  store i32 %{0}.accnext, i32* %a{1}, align 4'.format(lp, depth))
+
+
+def gen_function(out, f, loops, depth):
+    params = ', '.join(['i32* %a{}'.format(d) for d in range(depth + 1)])
+    out.append('define void @kernel{}({}, i64 %n) {{'.format(f, params))
+    out.append('entry:')
+    out.append('  br label %l0')
+
+    prev = 'entry'
+    for l in range(loops):
+        gen_loop(out, l, depth, prev)
+        prev = 'l{}.exit'.format(l)
+        if l + 1 < loops:
+            out.append('  br label %l{}'.format(l + 1))
+
+    out.append('  ret void')
+    out.append('}')
+    out.append('')
+
+
+def gen_main(out, functions, depth):
+    out.append('define i32 @main() {')
+    out.append('entry:')
+    out.append('  %n = load i64, i64* @n, align 8')
+
+    for d in range(depth + 1):
+        out.append('  %m{0} = call {{ i64, i1 }} @llvm.umul.with.overflow.i64(i64 %n, i64 4)'.format(d))
+        out.append('  %m{0}.ov = extractvalue {{ i64, i1 }} %m{0}, 1'.format(d))
+        out.append('  %m{0}.sz = extractvalue {{ i64, i1 }} %m{0}, 0'.format(d))
+        out.append('  %m{0}.arg = select i1 %m{0}.ov, i64 -1, i64 %m{0}.sz'.format(d))
+        out.append('  %p{0} = call i8* @_Znam(i64 %m{0}.arg)'.format(d))
+        out.append('  %a{0} = bitcast i8* %p{0} to i32*'.format(d))
+
+    args = ', '.join(['i32* %a{}'.format(d) for d in range(depth + 1)])
+    for f in range(functions):
+        out.append('  call void @kernel{}({}, i64 %n)'.format(f, args))
+
+    out.append('  ret i32 0')
+    out.append('}')
+    out.append('')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('-f', '--functions', type=int, default=16,
+                        help='number of kernel functions')
+    parser.add_argument('-l', '--loops', type=int, default=16,
+                        help='number of loops per function')
+    parser.add_argument('-d', '--depth', type=int, default=2,
+                        help='indirection chain depth of each loop')
+    parser.add_argument('-o', '--output', default='-',
+                        help='output file (default: stdout)')
+    args = parser.parse_args()
+
+    out = []
+    out.append('; generated by gen_ir.py -f {} -l {} -d {}'.format(
+        args.functions, args.loops, args.depth))
+    out.append('')
+    # the element count is read from a global so that it is not constant
+    out.append('@n = global i64 1024')
+    out.append('')
+    out.append('declare i8* @_Znam(i64)')
+    out.append('declare { i64, i1 } @llvm.umul.with.overflow.i64(i64, i64)')
+    out.append('')
+
+    for f in range(args.functions):
+        gen_function(out, f, args.loops, args.depth)
+
+    gen_main(out, args.functions, args.depth)
+
+    text = '\n'.join(out) + '\n'
+    if args.output == '-':
+        sys.stdout.write(text)
+    else:
+        with open(args.output, 'w') as f:
+            f.write(text)
+
+
+if __name__ == '__main__':
+    main()
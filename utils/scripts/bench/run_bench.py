@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+
+"""Measures the compile time of the prefetcher passes on synthetic IR.
+
+For every configuration a module is generated with gen_ir.py and run through
+opt with -time-passes, once with the legacy pass manager (-prefetcher-codegen,
+which pulls in -prefetcher for every function) and once with the new pass
+manager (-passes=prodigy). The per-pass wall times are written as CSV, one
+row per configuration, pass manager, timing report and pass.
+"""
+
+import argparse
+import csv
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# functions, loops per function, indirection depth
+DEFAULT_CONFIGS = [
+    (4, 16, 2),
+    (16, 16, 2),
+    (64, 16, 2),
+    (16, 64, 2),
+    (16, 256, 2),
+    (16, 16, 8),
+    (16, 64, 8),
+]
+
+PIPELINES = {
+    'legacy': ['-enable-new-pm=0', '-load', '{plugin}', '-prefetcher-codegen'],
+    'new': ['-load-pass-plugin', '{plugin}', '-passes=prodigy'],
+}
+
+# "   0.0020 ( 50.0%)   0.0000 (  0.0%) ...   0.0020 ( 50.0%)  Name"
+TIMING_RE = re.compile(r'^\s*((?:[0-9.]+\s+\(\s*[0-9.]+%\)\s+)+)(.+?)\s*$')
+TIME_RE = re.compile(r'([0-9.]+)\s+\(')
+
+
+def parse_timings(report):
+    """Returns (report, pass name, wall time) tuples from -time-passes output.
+
+    The wall time is the last column of every row. The "Total" rows are kept,
+    since they give the end-to-end time of each report.
+    """
+    timings = []
+    group = ''
+    lines = report.splitlines()
+    for i, line in enumerate(lines):
+        # the report title sits between two "===---===" rules
+        if (0 < i < len(lines) - 1 and lines[i - 1].startswith('===-') and
+                lines[i + 1].startswith('===-')):
+            group = line.strip().strip('.').strip()
+            continue
+        m = TIMING_RE.match(line)
+        if not m:
+            continue
+        times = TIME_RE.findall(m.group(1))
+        timings.append((group, m.group(2), float(times[-1])))
+    return timings
+
+
+def count_instructions(path):
+    count = 0
+    with open(path) as f:
+        for line in f:
+            if line.startswith('  ') and not line.startswith('  br '):
+                count += 1
+    return count
+
+
+def run_config(args, tmpdir, config):
+    functions, loops, depth = config
+    ll = os.path.join(tmpdir, 'f{}_l{}_d{}.ll'.format(functions, loops, depth))
+    subprocess.check_call([sys.executable, os.path.join(BENCH_DIR, 'gen_ir.py'),
+                           '-f', str(functions), '-l', str(loops),
+                           '-d', str(depth), '-o', ll])
+    instructions = count_instructions(ll)
+
+    rows = []
+    for pm in args.pass_manager:
+        report = os.path.join(tmpdir, 'timing.txt')
+        cmd = [args.opt] + [a.format(plugin=args.plugin) for a in PIPELINES[pm]]
+        cmd += ['-time-passes', '-info-output-file=' + report,
+                '-disable-output', ll]
+
+        for _ in range(args.repeat):
+            with open(os.devnull, 'w') as null:
+                subprocess.check_call(cmd, stdout=null, stderr=null)
+
+            with open(report) as f:
+                timings = parse_timings(f.read())
+            os.remove(report)
+
+            for group, name, wall in timings:
+                rows.append([functions, loops, depth, instructions, pm, group,
+                             name, '{:.6f}'.format(wall)])
+
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--opt', default='opt', help='opt binary')
+    parser.add_argument('--plugin', required=True,
+                        help='path to the prefetcher plugin library')
+    parser.add_argument('--output', default='-',
+                        help='CSV output file (default: stdout)')
+    parser.add_argument('--repeat', type=int, default=1,
+                        help='runs per configuration')
+    parser.add_argument('--pass-manager', action='append',
+                        choices=sorted(PIPELINES.keys()),
+                        help='pass manager to measure (default: both)')
+    parser.add_argument('--config', action='append', metavar='F,L,D',
+                        help='functions, loops per function and indirection '
+                        'depth of a generated module (default: built-in set)')
+    args = parser.parse_args()
+
+    if not args.pass_manager:
+        args.pass_manager = ['legacy', 'new']
+
+    configs = DEFAULT_CONFIGS
+    if args.config:
+        configs = [tuple(int(v) for v in c.split(',')) for c in args.config]
+
+    out = sys.stdout if args.output == '-' else open(args.output, 'w')
+    writer = csv.writer(out)
+    writer.writerow(['functions', 'loops', 'depth', 'instructions',
+                     'pass_manager', 'report', 'pass', 'wall_seconds'])
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for config in configs:
+            writer.writerows(run_config(args, tmpdir, config))
+            out.flush()
+
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()